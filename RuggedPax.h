@@ -17,6 +17,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
 #include <Arduino.h>
+#include "isrProfile.h"
 
 
 #define CURRENT_SENSE_INPUT A6
@@ -26,11 +27,105 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
 
-extern volatile bool believedLocked;
-extern volatile bool believedLockedValid; // low for the first few seconds of startup
-extern volatile bool believedJammed;
+// Modules tell each other what happened through the event bus, rather than reading
+// each other's globals.  Who listens to what is a PROGMEM table in eventBus.cpp,
+// fixed at compile time, so publishing costs one pass over that short table and
+// nothing is allocated.  Publish from loop(), never from an interrupt handler.
+//
+// The first busStates events are states: the bus remembers the last value of each,
+// and it reads as BUS_UNKNOWN until its producer has published it.
+#define BUS_UNKNOWN 0xFF
+enum {
+  busDoor,      // 1 when all doors are closed, 0 otherwise (doorman)
+  busLock,      // 1 when the lock is believed locked, 0 if not (current sensing)
+  busJam,       // 1 when the lock is believed jammed (current sensing)
+  busMotion,    // 1 while the motion detector is active (doorman)
+  busStates,
+  busCard = busStates,  // a card was read; value is the card number
+  busKey,       // a key was pressed; value is the key (10 is *, 11 is #, 12 is bell),
+                // plus the reader number times 256
+  busBell,      // the doorbell was pressed; value 1 to ring the Paxton, 0 to quiet beeping
+  busRelay,     // a relay changed; value is the relay index (0-3), plus 0x100 if it's now on
+  busEvents
+};
+typedef bool (*busHandler)(byte event, uint32_t value);
+
+class eventBus {
+  public:
+    // Calls every subscriber to the event, and returns true if any of them
+    // handled it (a key press that was handled isn't sent on to the Paxton).
+    static bool publish(byte event, uint32_t value=0);
+    // Publishes a state event, only if the value is different from the last one.
+    static void publishState(byte event, byte value);
+    static byte state(byte event);
+};
 
 
+// This struct stands for one of the screens that can be reached via the push button.
+// Pages are constant and live in flash (PROGMEM), wired together at compile time, so
+// building the menu costs nothing at startup.  A page displays its PROGMEM message
+// (with %d replaced by arg, if arg is nonzero), and then its status message in RAM.
+// A page is skipped unless showIf is NULL or points at a byte equal to showWhen, so a
+// module "adds" its pages simply by setting its enable/option byte in setup().
+struct displayPage {
+  const char PROGMEM *rommsg;
+  char *msg;                              // status text in pageArena, or NULL
+  const displayPage * const *detail;      // NULL-terminated PROGMEM list reached with a long press
+  const byte *showIf;
+  byte showWhen;
+  byte arg;
+};
+
+// The only parts of the menu that live in RAM: the status text shown on some pages.
+// Every module's buffer is declared here, so the total is fixed at link time.
+struct pageArena_t {
+  char programmingMode[40];
+  char wiegandDiagnostics[60];
+  char doorStatus[30];
+  char lockStatus[30];
+  char doorbellStatus[50];
+};
+extern pageArena_t pageArena;
+
+// Counts latencies in power-of-two buckets: under 2, under 4, and so on up to
+// 2^19 (524 seconds in ms, or 524ms in us), then everything longer.
+#define LATENCY_BUCKETS 20
+struct latencyHistogram {
+  uint16_t bucket[LATENCY_BUCKETS];
+  uint16_t count;
+  uint32_t max;
+  void add(uint32_t value);
+  void print(const __FlashStringHelper *title, const __FlashStringHelper *units);
+};
+
+// Milliseconds since a millis() timestamp.  Unsigned subtraction stays right when
+// millis() wraps around after 49.7 days, as long as the interval itself is shorter.
+inline uint32_t millisSince(uint32_t stamp) { return millis() - stamp; }
+
+// A callback to be run from loop() after some milliseconds, once or periodically.
+// Timers are usually static, and need no setup; a running timer is kept in the
+// timerWheel, so starting, stopping and expiring them costs the same however
+// many there are.  Not for use from interrupt handlers.
+struct softTimer {
+  // Runs callback once, ms from now.  Restarts the timer if it's running.
+  void start(uint32_t ms, void (*callback)(void));
+  // Runs callback every ms, the first time ms from now.
+  void every(uint32_t ms, void (*callback)(void));
+  void stop();
+  bool running() const { return pprev != NULL; }
+
+  softTimer *next;
+  softTimer **pprev;   // the pointer pointing at this timer, NULL while stopped
+  uint32_t expires;    // millis()
+  uint32_t period;     // 0 for a one-shot
+  void (*callback)(void);
+};
+
+class timerWheel {
+public:
+  // Runs the callbacks of every timer that has come due.
+  static void loop();
+};
 
 class serialconfig {
 public:
@@ -42,6 +137,9 @@ class doorman {
 public:
   static setup();
   static loop();
+  static const displayPage menuPage;
+  static const displayPage motionMenuPage;
+  static const displayPage diagnosticsPage;
   static bool feature_enabled;
   static bool doorsClosed;
   static bool doorsOpen;
@@ -60,8 +158,12 @@ class eepromconfig {
 
   // IR codes: 87267xxx (example 87267014)
   // Translation option 14: Wiegand to Wiegand32 out GPIO14/15
+  // Translation options 26, 34, 37: Wiegand to Wiegand 26/34/37 bits with parity out GPIO14/15
   // Translation option 114: Wiegand to Paxton out GPIO14/15, LED in GPIO50 and ~out GPIO12
+  // Translation option 149: Paxton reader in GPIO42/49 (and Wiegand) to Wiegand32 out GPIO14/15
   // Translation option 160: Wiegand to Paxton out A0/A1, LED in A2 and ~out GPIO12
+  // Translation option 214: Wiegand to Paxton Reader 1 out GPIO14/15 and Reader 2 out A0/A1,
+  //   LED in GPIO50 and ~out GPIO12; readers are routed by option 76883xxx
   // 0 or 255: disable
   static byte get_translationoption();
   static void set_translationoption(byte opt);
@@ -92,6 +194,8 @@ class eepromconfig {
   // option 36 means relay will energize when DoorMan thinks door is closed (as configured)
   // option 37 means relay will energize when DoorMan thinks door is locked (as configured)
   // option 38 means relay will energize whenever DoorMan receives a "motion detected" signal
+  // option 47 means relay is switched by keypad actions (see keypadActions)
+  // option 48 means relay follows its relay rule (see relayRules)
   // option 112 means relay will energize when A12 is low.
   // 0 or 255: disable, relay does nothing.
   // IR Programming codes: 0010nppp where n is relay number, ppp is option.
@@ -99,6 +203,13 @@ class eepromconfig {
   static byte get_relayprogram(byte relaynumber1);
   static void set_relayprogram(byte relaynumber1, byte opt);
 
+  // relay_min_on is the shortest time a relay on program 8 or 112 stays on, in
+  // tenths of a second: a short click on the input is stretched to at least this.
+  // IR Programming codes: 0011nsss where n is relay number, sss is tenths (000-254).
+  //  Example 00111030 keeps relay 1 on for at least 3 seconds.
+  static byte get_relay_min_on(byte relaynumber1);
+  static void set_relay_min_on(byte relaynumber1, byte tenths);
+
   // current_sensing_option enables the behavior of detecting locked and jammed
   // status based on current flow.
   // option 91 activates behavior for SDC 1091 bolt lock.
@@ -113,6 +224,52 @@ class eepromconfig {
   static byte eepromconfig::get_doorbell_option();
   static void eepromconfig::set_doorbell_option(byte opt);
 
+  // 38737xxx - DUPLICATE CARD HOLD-OFF (38737 spells DUPES)
+  // xxx = tenths of a second during which a card that was just sent is not sent again,
+  // e.g. 38737020 for 2 seconds.  Keypresses are never held off.  0 or 255: off.
+  static byte eepromconfig::get_duplicate_holdoff();
+  static void eepromconfig::set_duplicate_holdoff(byte opt);
+
+  // 53973xxx - PIN ENTRY (53973 spells KEYPD), Paxton translation options only
+  // xxx = longest PIN (up to 16).  Keypresses are collected and sent to the Paxton in one
+  // burst, ending in #, when # is pressed, the PIN is that long, or after 5 seconds
+  // without a key.  26-bit messages with facility code 0 are taken as a whole PIN.
+  // 0 or 255: off, each keypress is sent as it comes.
+  static byte eepromconfig::get_pin_entry_option();
+  static void eepromconfig::set_pin_entry_option(byte opt);
+
+  // 73237xxx - WIEGAND READERS (73237 spells READR), when a translation option is set
+  // xxx = how many readers, 1 to 4.  Reader 0 is on GPIO18/19, reader 1 on GPIO2/3,
+  // reader 2 on GPIO53/52 and reader 3 on GPIO51/10 (D0/D1).  0 or 255: 1 reader.
+  static byte eepromconfig::get_reader_count();
+  static void eepromconfig::set_reader_count(byte opt);
+  static byte eepromconfig::get_route_option();
+  static void eepromconfig::set_route_option(byte opt);
+  // 67377b0n - OSDP READERS (67377 spells OSDPR), see osdp
+  // b = baud rate (0-4: 9600, 19200, 38400, 57600, 115200), n = reader count (1-4).
+  // Stored as b*10 + n.  67377000: off.
+  static byte eepromconfig::get_osdp_option();
+  static void eepromconfig::set_osdp_option(byte opt);
+
+  // 36735xxx - EMERGENCY RELEASE (36735 spells EMREL), see emergencyRelease
+  // xxx = relays to release, 1 + 2 + 4 + 8 for relays 1-4, plus 16 to release them by
+  // energizing rather than de-energizing, plus 32 if the alarm grounds A11 (otherwise
+  // the alarm opens a contact holding A11 to ground).  0 or 255: off.
+  static byte eepromconfig::get_emergency_release_option();
+  static void eepromconfig::set_emergency_release_option(byte opt);
+
+  // Keypad action n (0-7), 4 bytes each.  IR codes 7827xsss (7827 spells STAR):
+  // the * key pulses relay x (1-4) for sss seconds, and sets relay x to program 47.
+  // sss = 000 removes it.  Any keys and actions can be set with KEYn= on serial.
+  static void eepromconfig::get_key_action(byte n, byte *action);
+  static void eepromconfig::set_key_action(byte n, const byte *action);
+
+  // Relay rule for relay n (0-3), 16 bytes of bytecode.  IR codes 7853xbbb (7853
+  // spells RULE) add byte bbb to relay x's rule and set relay x to program 48;
+  // bbb = 000 starts the rule over.  RULEn= on serial takes the rule as words.
+  static void eepromconfig::get_relay_rule(byte n, byte *code);
+  static void eepromconfig::set_relay_rule(byte n, const byte *code);
+
   // current_sensor_zero_point is typically 512 (~midpoint of 0-1023), and saves
   // what value is expected from the current sensor when current is zero.
   static uint16_t eepromconfig::get_current_sensor_zero_point();
@@ -120,28 +277,86 @@ class eepromconfig {
 
 };
 
-// This class stands for one of the screens that can be reached via the push button.
-// Create the object and call addDisplayPage() to add it to the list.
-// It can display up to one PROGMEM message, and then one message in RAM.
-class displayPage {
+// Starts the 200us Timer3 tick (translateWiegand.cpp), if it isn't running.  The
+// handler calls each module that uses it.
+void startTimer3();
+
+// The longest Wiegand message received
+#define WIEGAND_MAX_BITS 70
+
+class translateWiegand {
   public:
-    displayPage() {};
-    displayPage(char *newmsg) {msg=malloc(strlen(newmsg)+1); strcpy(msg,newmsg);};
-    displayPage(__FlashStringHelper *newmsg) : rommsg((const char PROGMEM*)newmsg) {};
-    displayPage *onShortPress = NULL;
-    displayPage *onLongPress = NULL;
-    const char PROGMEM *rommsg = NULL;
-    char *msg = NULL;
-    displayPage* addDisplayPage(displayPage *msg);
-    displayPage* addLongPressDisplayPage(displayPage *msg);
+    static void setup();
+    static void loop();
+    static void pcint0_isr();
+    static void timer3_compA_isr();
+    // Prints the recent LED input edges to serial
+    static void printLedEdges();
+    // The Paxton LED input edges, numbered by a wrapping count.  getLedEdge() returns
+    // false if edge n is no longer (or not yet) in the ring of recent edges.
+    static byte ledEdgeTotal();
+    static bool getLedEdge(byte n, uint32_t *when, bool *on);
+    static bool ledIsOn();
+    // Prints recent swipe timings and the per-stage histograms to serial
+    static void printTrace();
+    // Prints the per-line counts of Wiegand pulses rejected as noise
+    static void printNoise();
+    // Prints each reader's message counts and learned timing
+    static void printReaders();
+    // Prints the duplicate card hold-off and its counts
+    static void printDuplicates();
+    // Takes a message read some other way (OSDP) as if Wiegand reader n had sent it.
+    // bits are packed first bit first, from the top of bits[0].
+    static void receiveFrame(byte n, const byte *bits, byte count);
+    static bool onEvent(byte event, uint32_t value);
+    static const displayPage menuPage;
+    static const displayPage diagnosticsPage;
+};
 
+// A message received in the Paxton reader protocol: its 4-bit words, from the 0x0b
+// start word to the 0x0f end word.  The parity word has been checked and dropped.
+struct paxtonMessage {
+  byte words[12];
+  byte length;
+  unsigned long when;  // millis()
+};
 
+// Receives the Paxton reader protocol on GPIO49 (clock) and GPIO42 (data), from a
+// Paxton reader or keypad, or sniffed off the wires to an ACU.
+class paxtonReceiver {
+  public:
+    // Starts receiving, if it isn't already.  With claim set, the caller takes every
+    // message with take(); otherwise loop() throws them away (after SNIFF prints them).
+    static void begin(bool claim);
+    static void loop();
+    static bool take(paxtonMessage &m);
+    // Decodes a card swipe, or a keypress (0-9, 10 for *, 11 for #, 12 for bell)
+    static bool cardNumber(const paxtonMessage &m, uint32_t *card);
+    static bool keypress(const paxtonMessage &m, byte *key);
+    static void printMessage(const paxtonMessage &m);
+    static void printStats();
+    // Print each message as it's taken
+    static bool sniffing;
 };
 
-class translateWiegand {
+// Polls OSDP card readers on RS-485 through USART1 (GPIO18/19, direction on GPIO4).
+class osdp {
+  public:
+    static void setup();
+    static void loop();
+    static void printStatus();
+    static bool feature_enabled;
+};
+
+// Reads the ACU's granted/denied verdicts from the Paxton LED line.
+class accessVerdict {
   public:
     static void setup();
     static void loop();
+    // Called by translateWiegand when a card has been sent to the Paxton, with the
+    // time taken since the last Wiegand bit arrived.
+    static void cardSent(uint32_t cardnumber, uint32_t companionMs);
+    static void printStats();
 };
 
 class lcdMenus {
@@ -157,36 +372,107 @@ class relayPrograms {
   public:
     static void setup();
     static void loop();
-    static void addRelayDetailPage(displayPage *dp);
+    static const displayPage menuPage;
+    // Shows the detail page describing program p on relay index i (0-3), for
+    // programs implemented elsewhere (such as the Doorman programs 35/36/37).
+    static void showRelayDetailPage(byte i, byte p);
+    // Drives relay index i (0-3), publishing busRelay when it changes.
+    static void setRelay(byte i, bool on);
+    static bool relayOn(byte i);
+    static bool onEvent(byte event, uint32_t value);
+    // Programs 8 and 112 run in these: A12 changes, and the 200us Timer3 tick.
+    static void pcint2_isr();
+    static void timer3_compA_isr();
 };
 
 class currentSensing {
   public:
     static void setup();
-    static void loop();
+    static const displayPage menuPage;
     static bool feature_enabled;
 
 };
 
-class leftOpenBeep {
+// Beep and LED patterns played on the card reader (GPIO11 beep, GPIO12 LED).
+class readerFeedback {
   public:
+    enum { leftOpen, granted, denied, jam };
+    static void setup();
     static void timer0_compA_isr();
+    // Starts playing a pattern, cutting short any pattern already playing.
+    static void play(byte pattern);
+    static bool isPlaying();
+    // True while a pattern using the LED is playing; the LED mirror must leave GPIO12 alone.
+    static bool ownsLed();
+    static bool onEvent(byte event, uint32_t value);
+};
+
+// Switches relays set to relay program 47 from keypad keys and key sequences.
+class keypadActions {
+  public:
     static void setup();
-    static void loop();
+    static bool onEvent(byte event, uint32_t value);
+    // Sets action n (0-7): the keys (0-9, 10 for *, 11 for #, 12 for bell) switch
+    // relay index relay: mode 0 pulses it for seconds, 1 toggles it, 2 latches it
+    // on until the next key.  No keys removes the action.
+    static void set(byte n, const byte *keys, byte count, byte relay, byte mode, byte seconds);
+    // Handles the serial command KEYn=keys,relay,action (given what follows KEY),
+    // returning false if it isn't valid.
+    static bool configure(const char *cmd);
+    static void printActions();
 };
 
-class doorbellButton {
+// Forces chosen relays to their release state from the A11 pin change interrupt,
+// overriding every relay program until cleared.
+class emergencyRelease {
   public:
     static void setup();
-    static void loop();
+    static void pcint2_isr();
+    // Ends the release, unless A11 is still in alarm.
+    static bool clear();
+    static void printStatus();
+    static bool feature_enabled;
+    // The relays held in their release state, one bit each; 0 when not released.
+    static volatile byte forced;
+    static const displayPage menuPage;
+    static const displayPage releasedPage;
 };
 
+// Drives relays set to relay program 48 from logic rules over the inputs, run again
+// only when an input a rule uses changes.
+class relayRules {
+  public:
+    static void setup();
+    static bool onEvent(byte event, uint32_t value);
+    // Handles the serial command RULEn=words (given what follows RULE), returning
+    // false if it isn't a valid rule.
+    static bool configure(const char *cmd);
+    // Adds bytecode op to the rule for relay index r (0-3); 0 starts it over.
+    static void append(byte r, byte op);
+    static void printRules();
+};
 
+class leftOpenBeep {
+  public:
+    static void setup();
+    static const displayPage menuPage;
+    static bool onEvent(byte event, uint32_t value);
+};
 
+class doorbellButton {
+  public:
+    static void setup();
+    static const displayPage program8Page;
+    static const displayPage program9Page;
+    static const displayPage program18Page;
+    static const displayPage program19Page;
+    static const displayPage statusPage;
+};
 
 
 
-displayPage* addDisplayPage(displayPage *msg);
-extern displayPage* diagnosticsPage;
+// Pages defined in the main sketch, at the top of the menu.
+extern const displayPage helloPage;
+extern const displayPage diagnosticsModePage;
 
 
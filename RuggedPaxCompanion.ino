@@ -46,14 +46,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //   Can report "door closed", "motion detected" and "door locked"
 //   (among other signals) to security systems.
 //
-// Possible future feature: Connect up to 4 Wiegand card readers, to open 4
+// Feature: Connect up to 4 Wiegand card readers (IR code 73237xxx), each received
+//   and decoded independently.
+//
+// Possible future feature: use the 4 Wiegand card readers to open 4
 //   different doors using all 4 relays, using single Paxton ACU for
 //   authentication and logging.
 //
-// Possible future feature: extend the Net2's "Turnstile Mode" so that its relay
-//   clicks (on Relay 1 or 2, signaling whether Reader 1 or 2 was used) can be lengthened to
-//   longer than 1 second, so the mode can be used to operate two different doors,
-//   each with independent logging and identity in the Net2 system.
+// Feature: Relay programs 8 and 112 mirror pin 8 and A12 onto relays from interrupts,
+//   with an optional minimum on-time (IR code 0011xsss).  This can extend the Net2's
+//   "Turnstile Mode" so that its relay clicks (on Relay 1 or 2, signaling whether
+//   Reader 1 or 2 was used) are lengthened to longer than 1 second, so the mode can be
+//   used to operate two different doors, each with independent logging and identity in
+//   the Net2 system.
 //
 // Possible future feature: send the Alarm output of the Paxton ACU to the
 //   beeper pin on Wiegand card readers.
@@ -67,9 +72,29 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // Possible future feature: Inhibit the motion detector with a button press
 //   inside the room, or a mode selectable on a PIN keypad.
 //
-// Possible future feature: allow a "privacy" mode that decides whether to
-//   send card reads to Reader1 or Reader2 on the ACU (which can have different
-//   access permissions).  Mode selected via switch or via PIN keypad.
+// Feature: Keypad actions: keys or key sequences on a reader's keypad pulse, toggle
+//   or latch relays set to relay program 47 (serial command KEYn=, IR code 7827xsss).
+//   The keys are kept from the ACU.
+//
+// Feature: Relay rules: a relay set to relay program 48 follows a logic expression
+//   over the inputs, e.g. door closed AND locked AND NOT jammed (serial command RULEn=,
+//   IR code 7853xbbb).  A rule runs again only when an input it uses changes.
+//
+// Feature: Emergency release: a fire alarm input on A11 forces chosen relays to release
+//   from its pin change interrupt, overriding every relay program until cleared
+//   (IR code 36735xxx, serial commands ER and ERCLEAR).
+//
+// Feature: OSDP card readers on RS-485 through USART1 (IR code 67377xxx), handled
+//   like Wiegand readers, with their LEDs following the Paxton's.
+//
+// Feature: Receive the Paxton reader protocol on GPIO49/42, to translate a Paxton
+//   reader or keypad to Wiegand32 (option 149), or to log the messages between a
+//   reader and the ACU (serial command SNIFF).
+//
+// Feature: "privacy" mode that decides whether to send card reads to Reader1
+//   or Reader2 on the ACU (which can have different access permissions).
+//   Translation option 214 drives both reader ports; IR code 76883xxx routes
+//   by reader, by a switch on A3, or keypad to Reader2.
 //
 // Feature: I2C slave that can be used for an outside network-enabled microcontroller
 //   (such as an ESP32 running ESPHome) to retrieve status information from the board.
@@ -87,27 +112,61 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
 const char PROGMEM helloString[] = "Ruggeduino Companion\n for Paxton Net2\n@chipguyhere firmware\n compiled " __DATE__;
-  
+const displayPage helloPage PROGMEM = { helloString };
+
+static const char PROGMEM diagnosticsModeText[] = "Diagnostics Mode\n\n\nHold button to enter";
+static const char PROGMEM diagnosticsTapText[] = "Diagnostics Mode\n\nTap button to\nselect diagnostic";
+static const displayPage diagnosticsTapPage PROGMEM = { diagnosticsTapText };
+static const displayPage * const diagnosticsPages[] PROGMEM = {
+  &diagnosticsTapPage,
+  &translateWiegand::diagnosticsPage,
+  &doorman::diagnosticsPage,
+  NULL
+};
+const displayPage diagnosticsModePage PROGMEM = { diagnosticsModeText, NULL, diagnosticsPages };
+
 
 Watchdog watchdog;
 
 
 
-ISR(TIMER0_COMPA_vect) { leftOpenBeep::timer0_compA_isr(); }
+ISR(TIMER0_COMPA_vect) {
+  ISR_PROFILE_BEGIN(ISR_SLOT_TIMER0_COMPA);
+  ISR_PROFILE_LATENCY(ISR_SLOT_TIMER0_COMPA, (uint8_t)(TCNT0 - OCR0A) * 64);
+  readerFeedback::timer0_compA_isr();
+  ISR_PROFILE_END(ISR_SLOT_TIMER0_COMPA);
+}
+
+ISR(PCINT0_vect) {
+  ISR_PROFILE_BEGIN(ISR_SLOT_PCINT0);
+  translateWiegand::pcint0_isr();
+  ISR_PROFILE_END(ISR_SLOT_PCINT0);
+}
+
+ISR(PCINT2_vect) {
+  ISR_PROFILE_BEGIN(ISR_SLOT_PCINT2);
+  emergencyRelease::pcint2_isr();
+  relayPrograms::pcint2_isr();
+  ISR_PROFILE_END(ISR_SLOT_PCINT2);
+}
+
+ISR(TIMER3_COMPA_vect) {
+  ISR_PROFILE_BEGIN(ISR_SLOT_TIMER3_COMPA);
+  ISR_PROFILE_LATENCY(ISR_SLOT_TIMER3_COMPA, TCNT3 * 8);
+  translateWiegand::timer3_compA_isr();
+  relayPrograms::timer3_compA_isr();
+  ISR_PROFILE_END(ISR_SLOT_TIMER3_COMPA);
+}
 
 // Array to hold next I2C response we will give when requested
 byte nextResponse[4];
 
-// Flags we are tracking globally, and available via I2C
-volatile bool believedLocked=false;
-volatile bool believedLockedValid=false; // if false, the believedLocked value is invalid, e.g. fresh boot
-volatile bool believedJammed=false;
-
 // Interrupt handler for receiving an I2C Write command from the ESP32.
 // In this context of I2C, Write means "Do Command".
 // Command code 0x21: sample and report (on subsequent read).
 // Only the single command code 0x21 is implemented.
 void onI2CReceive(int bytes) {
+  ISR_PROFILE_BEGIN(ISR_SLOT_I2C_RECEIVE);
   while (Wire.available()) {
     int c = Wire.read();
     if (c == 0x21) {
@@ -125,13 +184,14 @@ void onI2CReceive(int bytes) {
       // Second byte: status of whether we believe lock is locked
       // Same 2-bit idea: if we don't think our signal is "valid" yet, we send "no status".
       bs=0;
-      if (believedLockedValid) bs += (believedLocked ? 1 : 2);
+      byte locked = eventBus::state(busLock);
+      if (locked != BUS_UNKNOWN) bs += (locked ? 1 : 2);
       // 6 unused bits available for future use
       nextResponse[1] = bs;
 
       // Third byte: status of whether we think lock is jammed (i.e. ineffectively locked)
       bs=0;
-      if (believedLockedValid) bs += (believedLocked && believedJammed) ? 1 : 2;
+      if (locked != BUS_UNKNOWN) bs += (locked && eventBus::state(busJam) == 1) ? 1 : 2;
       // 6 unused bits available for future use
       nextResponse[2] = bs;
 
@@ -139,21 +199,25 @@ void onI2CReceive(int bytes) {
       nextResponse[3] = bs;
     } 
   }
+  ISR_PROFILE_END(ISR_SLOT_I2C_RECEIVE);
 }
 
-volatile long lastI2CRequest=0;
+volatile unsigned long lastI2CRequest=0;
 
 // Interrupt handler for receiving an I2C read.
 // We simply send the prepared response from the earlier Write command.
 void onI2CRequest(void) {
+  ISR_PROFILE_BEGIN(ISR_SLOT_I2C_REQUEST);
   Wire.write(nextResponse, 4);
   lastI2CRequest=millis();
+  ISR_PROFILE_END(ISR_SLOT_I2C_REQUEST);
 }
 
 
 
 void setup() {
   watchdog.enable(Watchdog::TIMEOUT_8S);
+  isrProfile::setup();
   Serial.begin(115200);
 
   // Initialize ourselves as an I2C slave on address 0x27 so we can respond to an ESP32
@@ -170,16 +234,18 @@ void setup() {
 
   // Say hello, identify the application and version.
   Serial.println((__FlashStringHelper*)helloString);
-  addDisplayPage(new displayPage((__FlashStringHelper*)helloString));
-
-  auto dp = addDisplayPage(new displayPage(F("Diagnostics Mode\n\n\nHold button to enter")));
-  diagnosticsPage = dp->addLongPressDisplayPage(new displayPage(F("Diagnostics Mode\n\nTap button to\nselect diagnostic")));
 
-
-  // Initialize all of the separate modules.
+  // Initialize all of the separate modules.  Emergency release goes first, so
+  // an alarm that's already on takes effect before anything else.
+  emergencyRelease::setup();
   lcdMenus::setup();
+  readerFeedback::setup();
+  osdp::setup();
   translateWiegand::setup();
+  accessVerdict::setup();
   relayPrograms::setup();
+  keypadActions::setup();
+  relayRules::setup();
   currentSensing::setup();
   serialconfig::setup();
   doorman::setup();
@@ -190,10 +256,6 @@ void setup() {
   // (so we can use it as a reset button / watchdog timer feed inhibit)
   pinMode(47, INPUT_PULLUP);
 
-  // Activate the timer 0 overflow interrupt so we get an interrupt every 1.024ms
-  // (1.024ms interval is 16000000/16384 or 976.5625 times per second)
-  TIMSK0 |= _BV(OCIE0A);
-
 
 }
 
@@ -205,13 +267,14 @@ void loop() {
   if (digitalRead(47)==HIGH) watchdog.reset();
 
   // Run the loop of all the various classes.
+  timerWheel::loop();
   lcdMenus::loop();
   translateWiegand::loop();
+  paxtonReceiver::loop();
+  osdp::loop();
+  accessVerdict::loop();
   relayPrograms::loop();
-  currentSensing::loop();
   serialconfig::loop();
   doorman::loop();
-  leftOpenBeep::loop();
-  doorbellButton::loop();
 
 }
@@ -0,0 +1,160 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Arduino.h"
+#include "RuggedPax.h"
+
+
+// Reads the ACU's verdict on a card from the Paxton LED line (translation options
+// 114 and 160), by the timing of its edges:
+//  - LED leaves its idle state and stays there: access granted
+//  - LED flashes (short pulses away from its idle state): access denied
+//  - LED settles back to its idle state: idle
+// Each verdict is matched with the card we last sent to the Paxton, and the time from
+// sending the card to the verdict is kept in a histogram, along with the time we took
+// ourselves to pass the card on.
+
+// A pulse away from idle shorter than this is a flash
+#define FLASH_MAX_MS 500
+// This many flashes means denied
+#define DENIED_FLASHES 2
+// Held away from idle this long, without flashing, means granted
+#define GRANTED_HOLD_MS 800
+// Back at idle with no edges for this long ends the event
+#define QUIET_MS 2000
+// An idle level that has changed and stayed changed this long is relearned
+#define RELEARN_MS 10000
+// A verdict more than this long after a card isn't about that card
+#define CARD_WINDOW_MS 10000
+
+static bool feature_enabled=false;
+
+enum { waiting, active, decided };
+static byte phase = waiting;
+static bool idleOn;           // LED state when nothing is going on
+static byte nextEdge;         // next LED edge number to read
+static uint32_t lastEdgeWhen; // micros()
+static uint32_t activeSince;  // micros() when the LED left its idle state
+static byte flashes;
+
+static uint32_t lastCard;
+static uint32_t lastCardWhen; // micros() when the card was sent
+static bool lastCardAnswered = true;
+
+static uint16_t grantedCount, deniedCount, unmatchedCount;
+static latencyHistogram companionLatency; // last Wiegand bit in, to Paxton message sent
+static latencyHistogram acuLatency;       // Paxton message sent, to the verdict on the LED
+
+
+static void accessVerdict::setup() {
+  byte opt = eepromconfig::get_translationoption();
+  if (opt != 114 && opt != 160) return;
+  feature_enabled = true;
+  idleOn = translateWiegand::ledIsOn();
+  nextEdge = translateWiegand::ledEdgeTotal();
+  lastEdgeWhen = micros();
+}
+
+
+static void accessVerdict::cardSent(uint32_t cardnumber, uint32_t companionMs) {
+  if (!feature_enabled) return;
+  lastCard = cardnumber;
+  lastCardWhen = micros();
+  lastCardAnswered = false;
+  companionLatency.add(companionMs);
+}
+
+
+static void report(const __FlashStringHelper *verdict) {
+  Serial.print(F("ACU verdict: "));
+  Serial.print(verdict);
+  uint32_t ms = (activeSince - lastCardWhen) / 1000;
+  if (!lastCardAnswered && ms < CARD_WINDOW_MS) {
+    lastCardAnswered = true;
+    acuLatency.add(ms);
+    Serial.print(F(", card "));
+    Serial.print(lastCard);
+    Serial.print(F(", "));
+    Serial.print(ms);
+    Serial.println(F("ms after it was sent"));
+  } else {
+    unmatchedCount++;
+    Serial.println(F(", no card"));
+  }
+}
+
+
+static void accessVerdict::loop() {
+  if (!feature_enabled) return;
+
+  // Work through the LED edges the interrupt has recorded since last time.
+  byte total = translateWiegand::ledEdgeTotal();
+  while (nextEdge != total) {
+    uint32_t when;
+    bool on;
+    if (!translateWiegand::getLedEdge(nextEdge++, &when, &on)) continue; // overrun, lost
+    uint32_t pulseMs = (when - lastEdgeWhen) / 1000;
+    lastEdgeWhen = when;
+    if (on != idleOn) {
+      if (phase == waiting) {
+        phase = active;
+        activeSince = when;
+        flashes = 0;
+      }
+    } else if (phase == active && pulseMs < FLASH_MAX_MS) {
+      flashes++;
+    }
+  }
+
+  bool on = translateWiegand::ledIsOn();
+  uint32_t quietMs = (micros() - lastEdgeWhen) / 1000;
+
+  if (phase == active) {
+    if (flashes >= DENIED_FLASHES) {
+      phase = decided;
+      deniedCount++;
+      report(F("denied"));
+    } else if (on != idleOn && quietMs >= GRANTED_HOLD_MS && flashes == 0) {
+      phase = decided;
+      grantedCount++;
+      report(F("granted"));
+    }
+  }
+
+  if (phase != waiting && on == idleOn && quietMs >= QUIET_MS) {
+    phase = waiting;
+    Serial.println(F("ACU verdict: idle"));
+  }
+
+  if (phase == waiting && on != idleOn && quietMs >= RELEARN_MS) idleOn = on;
+}
+
+
+static void accessVerdict::printStats() {
+  if (!feature_enabled) {
+    Serial.println(F("Needs translation option 114 or 160"));
+    return;
+  }
+  Serial.print(F("Granted "));
+  Serial.print(grantedCount);
+  Serial.print(F(", denied "));
+  Serial.print(deniedCount);
+  Serial.print(F(", verdicts with no card "));
+  Serial.println(unmatchedCount);
+  companionLatency.print(F("Companion, Wiegand in to Paxton out"), F("ms"));
+  acuLatency.print(F("ACU, Paxton out to LED verdict"), F("ms"));
+}
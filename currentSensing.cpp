@@ -35,8 +35,21 @@ static int lockedsamples=0;
 
 bool currentSensing::feature_enabled=false;
 
-displayPage lockDisplayPage;
-char lockStatus[30]="";
+static char *lockStatus = pageArena.lockStatus;
+
+static softTimer sampleTimer;
+static softTimer analysisTimer;
+static softTimer displayTimer;
+static byte analysisCount;   // counts up to 7, to skip the first few seconds
+
+static void takeReading();
+static void analyseReadings();
+static void showStatus();
+
+static const char PROGMEM menuText[] = "SDC 1091 jam detect:\n";
+const displayPage currentSensing::menuPage PROGMEM = {
+  menuText, pageArena.lockStatus, NULL, (const byte*)&currentSensing::feature_enabled, true
+};
 
 
 static void currentSensing::setup() {
@@ -47,127 +60,117 @@ static void currentSensing::setup() {
 
   currentSensing::feature_enabled=true;
 
-  lockDisplayPage.rommsg = PSTR("SDC 1091 jam detect:\n");
-  addDisplayPage(&lockDisplayPage);
-  lockDisplayPage.msg = lockStatus;
-
   current_sensor_zero_point = eepromconfig::get_current_sensor_zero_point();
 
+  sampleTimer.every(1, takeReading);
+  analysisTimer.every(500, analyseReadings);
+  displayTimer.every(500, showStatus);
 }
 
 
-static void currentSensing::loop() {
-  if (!currentSensing::feature_enabled) return;
-
-
-  long m = millis();
-  static long lastCurrentReading;
-
-  // Read the Current (Amps) from the current sensor, and put it in the currentReadings array.
-  if (m - lastCurrentReading >= 1) {
-    lastCurrentReading = m;
-    long currentReading = analogRead(CURRENT_SENSE_INPUT);
-    // APPLY ANY ADJUSTMENT ALGORITHM HERE
-    currentReading -= current_sensor_zero_point;
-    /*
-    float fcr = currentReading;
-    if (fcr < 0) fcr=-fcr;
-    int z = (currentReading < 0) ? -currentReading : currentReading;
-    if (fcr > 22) fcr = pow(fcr, 1.3);
-    currentReading = fcr;
-    if (z < 20) {
-      Serial.print('.');
-    } else if (z >= 15 && z < (15+36)) {
-      Serial.print("0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"[z-15]);
-    } else {
-      Serial.print('#');
-    }
-    //long z = currentReading * currentReading;
-    //int z = fcr;
-    //for (int zz=0; zz<sizeof(syms); zz++) {
-    //  if (z < thresholds[zz] || thresholds[zz]==0) {
-    //    Serial.print(syms[zz]);
-    //    break;
-    //  }
-    //}
-    if ((currentReadingCount % 120) == 0) Serial.println();
-*/
-    if (currentReading < 0) currentReading = -currentReading;
-    if (currentReading > 255) currentReading=255;
-
-    int idx = currentReadingCount % sizeof(currentReadings);
-    if (currentReadingCount >= sizeof(currentReadings)) histogram[currentReadings[idx]]--;
-    histogram[currentReading]++;
-    currentReadings[idx] = currentReading;
-    currentReadingCount++;
-    if (currentReadingCount >= sizeof(currentReadings)*2) currentReadingCount = sizeof(currentReadings);
+// Read the Current (Amps) from the current sensor, and put it in the currentReadings array.
+static void takeReading() {
+  long currentReading = analogRead(CURRENT_SENSE_INPUT);
+  // APPLY ANY ADJUSTMENT ALGORITHM HERE
+  currentReading -= current_sensor_zero_point;
+  /*
+  float fcr = currentReading;
+  if (fcr < 0) fcr=-fcr;
+  int z = (currentReading < 0) ? -currentReading : currentReading;
+  if (fcr > 22) fcr = pow(fcr, 1.3);
+  currentReading = fcr;
+  if (z < 20) {
+    Serial.print('.');
+  } else if (z >= 15 && z < (15+36)) {
+    Serial.print("0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"[z-15]);
+  } else {
+    Serial.print('#');
   }
+  //long z = currentReading * currentReading;
+  //int z = fcr;
+  //for (int zz=0; zz<sizeof(syms); zz++) {
+  //  if (z < thresholds[zz] || thresholds[zz]==0) {
+  //    Serial.print(syms[zz]);
+  //    break;
+  //  }
+  //}
+  if ((currentReadingCount % 120) == 0) Serial.println();
+*/
+  if (currentReading < 0) currentReading = -currentReading;
+  if (currentReading > 255) currentReading=255;
+
+  int idx = currentReadingCount % sizeof(currentReadings);
+  if (currentReadingCount >= sizeof(currentReadings)) histogram[currentReadings[idx]]--;
+  histogram[currentReading]++;
+  currentReadings[idx] = currentReading;
+  currentReadingCount++;
+  if (currentReadingCount >= sizeof(currentReadings)*2) currentReadingCount = sizeof(currentReadings);
+}
 
-  static int responsesshown=0;
-  static long lastHistoAnalysis;
-  if ((m - lastHistoAnalysis) > 500) {
-    lastHistoAnalysis = m;
+static void analyseReadings() {
+  if (analysisCount <= 6) analysisCount++;
 
-    long tt=0;
-    for (int i=30; i<256; i++) tt += histogram[i];
+  long tt=0;
+  for (int i=30; i<256; i++) tt += histogram[i];
  
-    int peakI=0;
-    int peakIval=1;
-    int sampleTotal=0;
-    for (int i=10; i<30; i++) {
-      int vv = histogram[i];
-      sampleTotal += vv;
-      vv += histogram[i+1];
-      vv += histogram[i-1];
-
-      if (vv > peakIval) peakIval=vv,peakI=i;
-    }
-    for (int i=30; i<255; i++) sampleTotal += histogram[i];
-
-    // if there's significant current flowing at least (200/1024) or 20% of the time, consider the door locked.
-    if (sampleTotal > 200) believedLocked=true; else believedLocked=false;
-    if (believedLockedValid==false && m > 3000) believedLockedValid=true;
-
-    // Compare the sample count at three quarters of the peak to the sample count at the top of the peak.
-    // If the lock is jammed, we'll get to the peak quicker, and there will be fewer samples at the 3/4 mark.
-    int fractionofI = peakI * 3 / 4;
-    int comparativeSample = histogram[fractionofI];
-    comparativeSample += histogram[fractionofI+1];
-    comsam = comparativeSample * 100 / peakIval;
-
-    if (believedLocked==false) {
-      lockedsamples=0;
-    } else {
-      lockedinfo[lockedsamples % lockedinfo_size]=comsam;
-      lockedsamples++;
-      if (lockedsamples>=lockedinfo_size*2) lockedsamples=lockedinfo_size;
-    }
-
-    if (lockedsamples < lockedinfo_size) {
-      believedJammed=false;
-    } else {
-      long avgI=0;
-      for (int i=0; i<lockedinfo_size; i++) avgI += lockedinfo[i];
-      avgI /= lockedinfo_size;
-      believedJammed = (avgI < 25);
-    }
-
-    if (believedLocked) {
-      Serial.print(F("Locked n="));
-      Serial.print(comsam);
-      Serial.println(F("%"));
-    }
+  int peakI=0;
+  int peakIval=1;
+  int sampleTotal=0;
+  for (int i=10; i<30; i++) {
+    int vv = histogram[i];
+    sampleTotal += vv;
+    vv += histogram[i+1];
+    vv += histogram[i-1];
+
+    if (vv > peakIval) peakIval=vv,peakI=i;
+  }
+  for (int i=30; i<255; i++) sampleTotal += histogram[i];
+
+  // if there's significant current flowing at least (200/1024) or 20% of the time, consider the door locked.
+  bool believedLocked = (sampleTotal > 200);
+
+  // Compare the sample count at three quarters of the peak to the sample count at the top of the peak.
+  // If the lock is jammed, we'll get to the peak quicker, and there will be fewer samples at the 3/4 mark.
+  int fractionofI = peakI * 3 / 4;
+  int comparativeSample = histogram[fractionofI];
+  comparativeSample += histogram[fractionofI+1];
+  comsam = comparativeSample * 100 / peakIval;
+
+  if (believedLocked==false) {
+    lockedsamples=0;
+  } else {
+    lockedinfo[lockedsamples % lockedinfo_size]=comsam;
+    lockedsamples++;
+    if (lockedsamples>=lockedinfo_size*2) lockedsamples=lockedinfo_size;
   }
 
-  m = millis();
-  static long millisSinceLastDisplay;
-  if (m - millisSinceLastDisplay > 500) {
-    millisSinceLastDisplay = m;
-    if (believedLocked) {
-      sprintf_P(lockStatus, PSTR("Locked n=%d%% %sjam"), comsam, believedJammed ? "" : "no");
-    } else {
-      strcpy_P(lockStatus, PSTR("Lock not engaged"));
-    }
-    lcdMenus::updateScreen();
+  bool believedJammed;
+  if (lockedsamples < lockedinfo_size) {
+    believedJammed=false;
+  } else {
+    long avgI=0;
+    for (int i=0; i<lockedinfo_size; i++) avgI += lockedinfo[i];
+    avgI /= lockedinfo_size;
+    believedJammed = (avgI < 25);
   }
-}
\ No newline at end of file
+  // For the first few seconds after boot, the histogram isn't full enough to go by.
+  if (analysisCount > 6) {
+    eventBus::publishState(busLock, believedLocked);
+    eventBus::publishState(busJam, believedJammed);
+  }
+
+  if (believedLocked) {
+    Serial.print(F("Locked n="));
+    Serial.print(comsam);
+    Serial.println(F("%"));
+  }
+}
+
+static void showStatus() {
+  if (eventBus::state(busLock) == 1) {
+    sprintf_P(lockStatus, PSTR("Locked n=%d%% %sjam"), comsam, eventBus::state(busJam) == 1 ? "" : "no");
+  } else {
+    strcpy_P(lockStatus, PSTR("Lock not engaged"));
+  }
+  lcdMenus::updateScreen();
+}
@@ -21,12 +21,64 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 static bool feature_enabled;
 static byte feature_cfg;
 
-static displayPage *featuredisplayPage;
-
-static long lastRing;
-static long lastRelease;
+static char *statusText = pageArena.doorbellStatus;
+
+static const char PROGMEM program8Text[] = "Doorbell program 8:\n"
+                                           " A8+A9 bell switch,\n"
+                                           " Bell sent as bell\n"
+                                           " keypress to Paxton";
+static const char PROGMEM program9Text[] = "Doorbell program 9:\n"
+                                           " A9+GND bell switch,\n"
+                                           " Bell sent as bell\n"
+                                           " keypress to Paxton";
+static const char PROGMEM program18Text[] = "Doorbell program 18:\n"
+                                            " A8+A9 bell switch,\n"
+                                            " pressing doorbell\n"
+                                            " stops LeftOpen beep";
+static const char PROGMEM program19Text[] = "Doorbell program 9:\n"
+                                            " A9+GND bell switch,\n"
+                                            " pressing doorbell\n"
+                                            " stops LeftOpen beep";
+static const char PROGMEM statusPageText[] = "Doorbell status:\n";
+
+const displayPage doorbellButton::program8Page PROGMEM = { program8Text, NULL, NULL, &feature_cfg, 8 };
+const displayPage doorbellButton::program9Page PROGMEM = { program9Text, NULL, NULL, &feature_cfg, 9 };
+const displayPage doorbellButton::program18Page PROGMEM = { program18Text, NULL, NULL, &feature_cfg, 18 };
+const displayPage doorbellButton::program19Page PROGMEM = { program19Text, NULL, NULL, &feature_cfg, 19 };
+const displayPage doorbellButton::statusPage PROGMEM = {
+  statusPageText, pageArena.doorbellStatus, NULL, (const byte*)&feature_enabled, true
+};
+
+static uint32_t lastRelease;
 static bool everRung=false;
-static bool everReleased=false;
+static bool rungLongAgo=false;  // rung, but more than 10 minutes ago
+static bool lastPressed;
+
+static softTimer pollTimer;
+static softTimer ringAgeTimer;
+
+static void ringAged() {
+  everRung=false;
+  rungLongAgo=true;
+}
+
+static void pollButton() {
+  bool pressed = digitalRead(A9)==LOW;
+  if (lastPressed==false && pressed) {
+    everRung=true;
+    ringAgeTimer.start(600000, ringAged);
+    eventBus::publish(busBell, (feature_cfg == 18 || feature_cfg == 19) ? 0 : 1);
+  } else if (lastPressed==true && !pressed) {
+    lastRelease=millis();
+  }
+  lastPressed = pressed;
+
+  if (everRung==false)
+    if (rungLongAgo) strcpy_P(statusText, PSTR("Last ring 10m+ ago\n"));
+    else strcpy_P(statusText, PSTR("No press since boot\n"));
+  else sprintf_P(statusText, PSTR("Last pressed:\n %d sec ago\n"), (int)(millisSince(lastRelease)/1000));
+  if (lastPressed) strcat_P(statusText, PSTR("PRESSED"));
+}
 
 
 static void doorbellButton::setup() {
@@ -34,81 +86,23 @@ static void doorbellButton::setup() {
 
   switch (feature_cfg) {
   case 8:
-    addDisplayPage(new displayPage(F( "Doorbell program 8:\n"
-                                          " A8+A9 bell switch,\n"
-                                          " Bell sent as bell\n"
-                                          " keypress to Paxton")));
-    pinMode(A8, OUTPUT);
-    digitalWrite(A8, LOW);                                          
-    break;
-
-  case 9:
-    addDisplayPage(new displayPage(F( "Doorbell program 9:\n"
-                                          " A9+GND bell switch,\n"
-                                          " Bell sent as bell\n"
-                                          " keypress to Paxton"))); break;
-
   case 18:
-    addDisplayPage(new displayPage(F( "Doorbell program 18:\n"
-                                          " A8+A9 bell switch,\n"
-                                          " pressing doorbell\n"
-                                          " stops LeftOpen beep")));
     pinMode(A8, OUTPUT);
-    digitalWrite(A8, LOW);                                          
+    digitalWrite(A8, LOW);
     break;
 
+  case 9:
   case 19:
-    addDisplayPage(new displayPage(F( "Doorbell program 9:\n"
-                                          " A9+GND bell switch,\n"
-                                          " pressing doorbell\n"
-                                          " stops LeftOpen beep"))); break;
+    break;
 
   default:
     feature_cfg=0;
     return;
   }
 
-  featuredisplayPage = new displayPage(F("Doorbell status:\n"));
-  addDisplayPage(featuredisplayPage);
-  featuredisplayPage->msg = malloc(50);
-  strcpy_P(featuredisplayPage->msg, PSTR(""));
+  strcpy_P(statusText, PSTR(""));
 
   pinMode(A9, INPUT_PULLUP);
   feature_enabled=true;
-}
-
-bool inhibitLeftOpenBeep(void);
-void paxtonSendBell();
-
-static void doorbellButton::loop() {
-  if (!feature_enabled) return;
-
-  static long lastCheck;
-  static bool lastPressed;
-  long m = millis();
-  if (m - lastCheck > 100) {
-    lastCheck = m;
-    bool pressed = digitalRead(A9)==LOW;
-    if (lastPressed==false && pressed) {
-      lastRing=m;
-      everRung=true;
-      if (feature_cfg == 18 || feature_cfg == 19) {
-        inhibitLeftOpenBeep();
-      } else {
-        paxtonSendBell();
-      }
-    } else if (lastPressed==true && !pressed) {
-      lastRelease=m;
-      everReleased=true;
-    }
-    lastPressed = pressed;
-  }
-  if (everRung && m-lastRing>600000) everRung=false,lastRing=1;
-  if (everReleased && m-lastRelease>600000) everReleased=false,lastRelease=1;
-  if (everRung==false)
-    if (lastRing==1) strcpy_P(featuredisplayPage->msg, PSTR("Last ring 10m+ ago\n"));
-    else strcpy_P(featuredisplayPage->msg, PSTR("No press since boot\n"));
-  else sprintf_P(featuredisplayPage->msg, PSTR("Last pressed:\n %d sec ago\n"), (m-lastRelease)/1000L);
-  if (lastPressed) strcat_P(featuredisplayPage->msg, PSTR("PRESSED"));
-
+  pollTimer.every(100, pollButton);
 }
@@ -36,6 +36,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
  * 16 = Relay 4 program
  * 20 = Current sensing option
  * 21 = Doorbell option
+ * 22 = Duplicate card hold-off
+ * 23 = PIN entry option
+ * 24 = Wiegand reader count
+ * 25 = Output routing for translation option 214
+ * 26 = OSDP readers and baud rate (baud index * 10 + readers)
+ * 27 = Emergency release option
+ * 28-31 = Relay 1-4 minimum on-time (programs 8 and 112)
+ * 32-63 = Keypad actions, 4 bytes each
+ * 64-127 = Relay rules, 16 bytes each
 
  */
 
@@ -73,11 +82,69 @@ static void eepromconfig::set_relayprogram(byte relaynumber1, byte opt) {
   }
 }
 
+static byte eepromconfig::get_relay_min_on(byte relaynumber1) { return EEPROM.read(relaynumber1+28-1); }
+
+static void eepromconfig::set_relay_min_on(byte relaynumber1, byte tenths) {
+  if (relaynumber1 >= 1 && relaynumber1 <= 4) {
+    EEPROM.update(relaynumber1+28-1, tenths);
+  }
+}
+
 
 static byte eepromconfig::get_current_sensing_option() { return EEPROM.read(20); }
 static void eepromconfig::set_current_sensing_option(byte opt) { EEPROM.update(20, opt); }
 static byte eepromconfig::get_doorbell_option() { return (byte)(EEPROM.read(21)); }
 static void eepromconfig::set_doorbell_option(byte opt) { EEPROM.update(21, opt); }
+static byte eepromconfig::get_duplicate_holdoff() {
+  byte rv = EEPROM.read(22);
+  if (rv == 255) return 0;
+  return rv;
+}
+static void eepromconfig::set_duplicate_holdoff(byte opt) { EEPROM.update(22, opt); }
+static byte eepromconfig::get_pin_entry_option() {
+  byte rv = EEPROM.read(23);
+  if (rv == 255) return 0;
+  return rv;
+}
+static void eepromconfig::set_pin_entry_option(byte opt) { EEPROM.update(23, opt); }
+static byte eepromconfig::get_reader_count() {
+  byte rv = EEPROM.read(24);
+  if (rv >= 1 && rv <= 4) return rv;
+  return 1;
+}
+static void eepromconfig::set_reader_count(byte opt) { EEPROM.update(24, opt); }
+
+static byte eepromconfig::get_route_option() {
+  byte rv = EEPROM.read(25);
+  if (rv > 3) return 0;
+  return rv;
+}
+static void eepromconfig::set_route_option(byte opt) { EEPROM.update(25, opt); }
+
+static byte eepromconfig::get_osdp_option() {
+  byte rv = EEPROM.read(26);
+  if (rv == 255) return 0;
+  return rv;
+}
+static void eepromconfig::set_osdp_option(byte opt) { EEPROM.update(26, opt); }
+
+static byte eepromconfig::get_emergency_release_option() { return EEPROM.read(27); }
+static void eepromconfig::set_emergency_release_option(byte opt) { EEPROM.update(27, opt); }
+
+static void eepromconfig::get_key_action(byte n, byte *action) {
+  for (byte i=0; i<4; i++) action[i] = EEPROM.read(32 + n*4 + i);
+}
+static void eepromconfig::set_key_action(byte n, const byte *action) {
+  for (byte i=0; i<4; i++) EEPROM.update(32 + n*4 + i, action[i]);
+}
+
+// Relay rule bytecode for relay n (0-3), see relayRules
+static void eepromconfig::get_relay_rule(byte n, byte *code) {
+  for (byte i=0; i<16; i++) code[i] = EEPROM.read(64 + n*16 + i);
+}
+static void eepromconfig::set_relay_rule(byte n, const byte *code) {
+  for (byte i=0; i<16; i++) EEPROM.update(64 + n*16 + i, code[i]);
+}
 
 
 
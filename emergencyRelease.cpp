@@ -0,0 +1,177 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Arduino.h"
+#include "RuggedPax.h"
+
+
+// Emergency release: a fire alarm contact on A11 drops lock power at once.
+//
+// Everything else that switches relays runs from loop(), which can be held up for
+// tens of milliseconds by a Paxton frame or a display update.  This runs in the
+// pin change interrupt instead: the handler writes the relay port itself, a few
+// microseconds after the edge.  The release latches until cleared with ERCLEAR
+// (or a reboot), and while it holds, relayPrograms::setRelay() leaves the released
+// relays alone.
+
+#define RELEASE_INPUT A11      // PK3, PCINT19
+#define RELEASE_INPUT_BIT 3
+
+// Option bits (36735xxx)
+#define OPTION_RELAYS 0x0F     // relays 1-4 to release
+#define OPTION_ENERGIZE 0x10   // release by energizing the relays, not de-energizing
+#define OPTION_GROUNDED 0x20   // the alarm grounds A11, rather than opening a closed contact
+
+bool emergencyRelease::feature_enabled;
+volatile byte emergencyRelease::forced;
+static volatile byte state;          // 1 armed, 2 released: picks the menu page
+static byte releaseMask;             // the relays to release, one bit each
+static byte activeLevel;             // A11 reading (0 or _BV(3)) that means alarm
+
+static volatile uint8_t *relayPort;  // the relays all sit on one port (GPIO31-34, PORTC)
+static uint8_t portClear, portSet;   // port bits to clear and set on release
+
+static volatile uint16_t releaseCount;
+static volatile uint16_t lastTicks, maxTicks;   // handler entry to relays written, Timer4 ticks (0.5us)
+static bool reported;
+
+static softTimer reportTimer;
+
+static const char PROGMEM armedText[] = "Emergency release\n"
+                                        " armed on A11";
+static const char PROGMEM releasedText[] = "EMERGENCY RELEASE\n"
+                                           " relays released\n"
+                                           " by A11.  ERCLEAR\n"
+                                           " on serial to reset";
+const displayPage emergencyRelease::menuPage PROGMEM = { armedText, NULL, NULL, (const byte*)&state, 1 };
+const displayPage emergencyRelease::releasedPage PROGMEM = { releasedText, NULL, NULL, (const byte*)&state, 2 };
+
+
+static inline bool inputActive() {
+  return (PINK & _BV(RELEASE_INPUT_BIT)) == activeLevel;
+}
+
+// Called with interrupts off.  entered is TCNT4 when the handler started.
+static inline void release(uint16_t entered) {
+  *relayPort = (*relayPort & ~portClear) | portSet;
+  uint16_t ticks = TCNT4 - entered;
+  releaseCount++;
+  emergencyRelease::forced = releaseMask;
+  state = 2;
+  lastTicks = ticks;
+  if (ticks > maxTicks) maxTicks = ticks;
+}
+
+static void emergencyRelease::pcint2_isr() {
+  uint16_t entered = TCNT4;
+  if (releaseMask && !forced && inputActive()) release(entered);
+}
+
+// Tells the serial port and the screen about a release, from loop()
+static void reportRelease() {
+  if (!emergencyRelease::forced || reported) return;
+  reported = true;
+  Serial.println(F("EMERGENCY RELEASE by A11"));
+  lcdMenus::updateScreen();
+}
+
+
+static void emergencyRelease::setup() {
+  byte opt = eepromconfig::get_emergency_release_option();
+  releaseMask = opt & OPTION_RELAYS;
+  if (opt == 0xFF || !releaseMask) return;
+  feature_enabled = true;
+  activeLevel = (opt & OPTION_GROUNDED) ? 0 : _BV(RELEASE_INPUT_BIT);
+
+  relayPort = portOutputRegister(digitalPinToPort(FIRST_RELAY_GPIO));
+  for (byte i=0; i<4; i++) {
+    if (!(releaseMask & (1 << i))) continue;
+    byte bit = digitalPinToBitMask(FIRST_RELAY_GPIO+i);
+    if (opt & OPTION_ENERGIZE) portSet |= bit;
+    else portClear |= bit;
+    pinMode(FIRST_RELAY_GPIO+i, OUTPUT);
+  }
+
+  // Timer4 counts in 0.5us ticks, for timing the release.  The core starts it as
+  // 8-bit phase correct PWM at /64, so it's set up the way the Wiegand translation
+  // and Paxton receiver run it: normal mode, /8.
+  TCCR4A = 0;
+  TCCR4B = _BV(CS41);
+  TCCR4C = 0;
+
+  pinMode(RELEASE_INPUT, INPUT_PULLUP);
+  delayMicroseconds(10);  // let the pull-up charge the line
+  noInterrupts();
+  state = 1;
+  if (inputActive()) release(TCNT4);  // an alarm already on at power-up
+  PCMSK2 |= _BV(PCINT19);
+  PCIFR = _BV(PCIF2);
+  PCICR |= _BV(PCIE2);
+  interrupts();
+
+  reportTimer.every(100, reportRelease);
+}
+
+// Ends a release, if the alarm has cleared, putting the relays back as their
+// programs have them.
+static bool emergencyRelease::clear() {
+  if (!forced) return true;
+  noInterrupts();
+  if (inputActive()) {
+    interrupts();
+    return false;
+  }
+  byte was = forced;
+  forced = 0;
+  state = 1;
+  for (byte i=0; i<4; i++) {
+    if (was & (1 << i)) digitalWrite(FIRST_RELAY_GPIO+i, relayPrograms::relayOn(i) ? HIGH : LOW);
+  }
+  interrupts();
+  reported = false;
+  lcdMenus::updateScreen();
+  return true;
+}
+
+static void emergencyRelease::printStatus() {
+  if (!feature_enabled) {
+    Serial.println(F("Emergency release is off (IR code 36735xxx)"));
+    return;
+  }
+  noInterrupts();
+  byte f = forced;
+  uint16_t count = releaseCount, last = lastTicks, max = maxTicks;
+  interrupts();
+  Serial.print(F("Emergency release on A11, relays "));
+  for (byte i=0; i<4; i++) {
+    if (releaseMask & (1 << i)) Serial.print((char)('1'+i));
+  }
+  Serial.println(f ? F(": RELEASED") : F(": armed"));
+  Serial.print(F("A11 is "));
+  Serial.println(inputActive() ? F("in alarm") : F("normal"));
+  Serial.print(F("Releases: "));
+  Serial.println(count);
+  if (count) {
+    // Edge to handler entry adds the hardware response, plus however long the
+    // longest interrupts-off stretch runs (see ISR).
+    Serial.print(F("Handler entry to relays written: last "));
+    Serial.print(last / 2);
+    Serial.print(last & 1 ? F(".5us, max ") : F("us, max "));
+    Serial.print(max / 2);
+    Serial.println(max & 1 ? F(".5us") : F("us"));
+  }
+}
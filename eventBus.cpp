@@ -0,0 +1,67 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Arduino.h"
+#include "RuggedPax.h"
+
+
+struct busSubscriber {
+  byte event;
+  busHandler handler;
+};
+
+// Every subscription, in the order the handlers are called.  A module hooks in by
+// adding its rows here; the modules publishing the events don't change.
+static const busSubscriber subscribers[] PROGMEM = {
+  { busDoor,   leftOpenBeep::onEvent },      // times the left-open beeps
+  { busDoor,   relayRules::onEvent },        // relay program 48
+  { busLock,   relayPrograms::onEvent },     // relay program 20
+  { busLock,   relayRules::onEvent },
+  { busJam,    readerFeedback::onEvent },    // jam pattern on the reader
+  { busJam,    relayRules::onEvent },
+  { busMotion, relayPrograms::onEvent },     // relay program 38
+  { busMotion, relayRules::onEvent },
+  { busKey,    keypadActions::onEvent },     // action keys switch relays
+  { busKey,    leftOpenBeep::onEvent },      // * quiets the left-open beep
+  { busBell,   leftOpenBeep::onEvent },      // doorbell programs 18/19
+  { busBell,   translateWiegand::onEvent },  // doorbell programs 8/9
+};
+#define BUS_SUBSCRIBERS (sizeof(subscribers) / sizeof(subscribers[0]))
+
+// Also read by the I2C status request handler
+static volatile byte states[busStates] = { BUS_UNKNOWN, BUS_UNKNOWN, BUS_UNKNOWN, BUS_UNKNOWN };
+
+
+static bool eventBus::publish(byte event, uint32_t value) {
+  if (event < busStates) states[event] = value;
+  bool handled = false;
+  for (byte i=0; i<BUS_SUBSCRIBERS; i++) {
+    if (pgm_read_byte(&subscribers[i].event) != event) continue;
+    busHandler handler = (busHandler)pgm_read_ptr(&subscribers[i].handler);
+    if ((*handler)(event, value)) handled = true;
+  }
+  return handled;
+}
+
+static void eventBus::publishState(byte event, byte value) {
+  if (states[event] == value) return;
+  publish(event, value);
+}
+
+static byte eventBus::state(byte event) {
+  return states[event];
+}
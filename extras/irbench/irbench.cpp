@@ -0,0 +1,267 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Host-side benchmark for the infrared decoders in irDecode.h.
+// Feeds edge traces through the same decoders the Timer5 capture interrupt uses,
+// checks what was decoded, and reports the cost per edge in host CPU cycles along
+// with how many timeout (Timer5 compare B) interrupts the trace would have caused.
+//
+// Build and run on a PC (not part of the Arduino sketch):
+//   g++ -O2 -o irbench extras/irbench/irbench.cpp && ./irbench [trace.txt ...]
+//
+// A trace file has one edge per line: F or R (fall/rise of the IR receiver output),
+// then the microseconds since the previous edge, e.g. "F 40000" then "R 9050".
+// Lines starting with # are ignored.  Traces captured with a logic analyzer can be
+// exported to this format.  Without arguments, the built-in traces are used.
+
+#include "../../irDecode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t cycles() { return __rdtsc(); }
+#define CYCLE_UNIT "TSC cycles"
+#else
+static inline uint64_t cycles() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#define CYCLE_UNIT "ns"
+#endif
+
+struct irEdge {
+  bool fall;
+  uint32_t ticks;
+};
+
+struct irTrace {
+  std::string name;
+  std::vector<irEdge> edges;
+};
+
+static void addEdge(irTrace &t, bool fall, uint32_t us) {
+  t.edges.push_back({fall, us / 4});
+}
+
+// Hands one edge to the decoder the way irMega48.cpp does: any timeouts the decoder
+// asks for (compare B interrupts on the Arduino) are delivered first.
+// Counts the timeouts in *timeouts.
+// Returns what the timeouts and the edge decoded, or'ed together.
+static inline uint8_t feed(irDecoder &d, const irEdge &e, unsigned long *timeouts) {
+  uint32_t ticks = e.ticks;
+  uint16_t wait;
+  uint8_t got = 0;
+  while ((wait = d.nextTimeout()) != 0 && ticks >= wait) {
+    got |= d.timeout(wait);
+    ticks -= wait;
+    ++*timeouts;
+  }
+  return got | d.edge(e.fall, (uint16_t)ticks);
+}
+
+// Messages as seen at the receiver output.  Receivers stretch marks and
+// shorten spaces by roughly 50us, which is reproduced here.
+
+static void addNecMessage(irTrace &t, uint32_t idleus, uint8_t addr, uint8_t addrinv, uint8_t cmd,
+                          uint32_t leadus = 9050) {
+  uint32_t bits = addr | ((uint32_t)addrinv << 8) | ((uint32_t)cmd << 16) | ((uint32_t)(uint8_t)~cmd << 24);
+  addEdge(t, true, idleus);
+  addEdge(t, false, leadus);
+  addEdge(t, true, 4450);
+  for (int i=0; i<32; i++) {
+    addEdge(t, false, 610);
+    addEdge(t, true, (bits >> i) & 1 ? 1640 : 515);
+  }
+  addEdge(t, false, 610);
+}
+
+static void addNecRepeat(irTrace &t, uint32_t idleus) {
+  addEdge(t, true, idleus);
+  addEdge(t, false, 9050);
+  addEdge(t, true, 2200);
+  addEdge(t, false, 610);
+}
+
+// RC5: 14 Manchester bits of two 889us halves, 1 = space then mark.
+static void addRc5Message(irTrace &t, uint32_t idleus, bool toggle, uint8_t addr, uint8_t cmd) {
+  uint16_t bits = 0x2000 | ((cmd & 0x40) ? 0 : 0x1000) | (toggle ? 0x800 : 0) | ((addr & 0x1F) << 6) | (cmd & 0x3F);
+  bool levels[28];
+  for (int i=0; i<14; i++) {
+    bool one = (bits >> (13 - i)) & 1;
+    levels[i*2] = !one;
+    levels[i*2+1] = one;
+  }
+  // The first half of the start bit is a space, and merges into the idle time.
+  int i = 1;
+  addEdge(t, true, idleus);
+  while (i < 28) {
+    bool mark = levels[i];
+    int n = 0;
+    while (i < 28 && levels[i] == mark) n++, i++;
+    if (i == 28 && !mark) break; // trailing space runs into the idle time
+    addEdge(t, mark ? false : true, n * 889 + (mark ? 50 : -50));
+  }
+}
+
+// Sony SIRC: 2.4ms leading mark, then bits LSB first as 1200us/600us marks after 600us spaces.
+static void addSircMessage(irTrace &t, uint32_t idleus, int nbits, uint32_t bits) {
+  addEdge(t, true, idleus);
+  addEdge(t, false, 2450);
+  for (int i=0; i<nbits; i++) {
+    addEdge(t, true, 550);
+    addEdge(t, false, (bits >> i) & 1 ? 1250 : 650);
+  }
+}
+
+static std::vector<irTrace> builtinTraces() {
+  std::vector<irTrace> traces;
+
+  irTrace hobby{"NEC hobby remote key 5, held for two repeats", {}};
+  addNecMessage(hobby, 200000, 0x00, 0xFF, 0x1C);
+  addNecRepeat(hobby, 40000);
+  addNecRepeat(hobby, 96000);
+  traces.push_back(hobby);
+
+  irTrace extended{"NEC extended address 0x1234, cmd 0x40", {}};
+  addNecMessage(extended, 200000, 0x34, 0x12, 0x40);
+  traces.push_back(extended);
+
+  irTrace idle{"one key press, then ten seconds idle", {}};
+  addNecMessage(idle, 200000, 0x00, 0xFF, 0x45);
+  addEdge(idle, true, 10000000);
+  addEdge(idle, false, 560);
+  traces.push_back(idle);
+
+  irTrace samsung{"Samsung TV key 1, held for a second frame", {}};
+  addNecMessage(samsung, 200000, 0x07, 0x07, 0x04, 4550);
+  addNecMessage(samsung, 46000, 0x07, 0x07, 0x04, 4550);
+  addEdge(samsung, false, 200000);
+  traces.push_back(samsung);
+
+  irTrace rc5{"RC5 TV key 1 held for two frames, then pressed again", {}};
+  addRc5Message(rc5, 200000, false, 0, 1);
+  addRc5Message(rc5, 89000, false, 0, 1);
+  addRc5Message(rc5, 89000, true, 0, 1);
+  addEdge(rc5, false, 200000);
+  traces.push_back(rc5);
+
+  irTrace sirc{"Sony TV key 1, 12-bit, sent three times", {}};
+  for (int i=0; i<3; i++) addSircMessage(sirc, i ? 25000 : 200000, 12, 0x080);
+  addEdge(sirc, false, 200000);
+  traces.push_back(sirc);
+
+  irTrace sirc20{"Sony 20-bit, device 26 extended 0x5A, command 0x2B", {}};
+  addSircMessage(sirc20, 200000, 20, 0x2B | (26 << 7) | (0x5AUL << 12));
+  addEdge(sirc20, false, 200000);
+  traces.push_back(sirc20);
+
+  irTrace noise{"noise: short random pulses", {}};
+  uint32_t seed = 12345;
+  for (int i=0; i<200; i++) {
+    seed = seed * 1103515245 + 12345;
+    addEdge(noise, (i & 1) == 0, 50 + (seed >> 16) % 3000);
+  }
+  traces.push_back(noise);
+
+  return traces;
+}
+
+static bool loadTrace(const char *path, irTrace &t) {
+  FILE *f = fopen(path, "r");
+  if (!f) return false;
+  t.name = path;
+  char line[128];
+  while (fgets(line, sizeof(line), f)) {
+    char kind;
+    unsigned long us;
+    if (line[0] == '#') continue;
+    if (sscanf(line, " %c %lu", &kind, &us) != 2) continue;
+    addEdge(t, kind == 'F' || kind == 'f', us);
+  }
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  std::vector<irTrace> traces;
+  if (argc > 1) {
+    for (int i=1; i<argc; i++) {
+      irTrace t;
+      if (!loadTrace(argv[i], t)) {
+        fprintf(stderr, "can't read %s\n", argv[i]);
+        return 1;
+      }
+      traces.push_back(t);
+    }
+  } else {
+    traces = builtinTraces();
+  }
+
+  const int runs = 20000;
+
+  for (auto &t : traces) {
+    // Decode once, reporting what came out.
+    irDecoder d;
+    unsigned long timeouts = 0;
+    printf("%s: %zu edges\n", t.name.c_str(), t.edges.size());
+    for (auto &e : t.edges) {
+      uint8_t got = feed(d, e, &timeouts);
+      if (got & IR_GOT_MESSAGE) printf("  message %08lX\n", (unsigned long)d.message);
+      if (got & IR_GOT_REPEAT) printf("  repeat\n");
+    }
+    printf("  %lu timeout interrupts\n", timeouts);
+
+    // Average cost: the whole trace, many times over.
+    uint64_t best = ~0ULL;
+    volatile uint8_t sink = 0;
+    unsigned long ignored = 0;
+    for (int r=0; r<runs; r++) {
+      irDecoder bd;
+      uint64_t c0 = cycles();
+      for (auto &e : t.edges) sink += feed(bd, e, &ignored);
+      uint64_t c = cycles() - c0;
+      if (c < best) best = c;
+    }
+
+    // Worst case: each edge timed alone, taking the best of many runs for each
+    // edge (to remove interference), then the slowest edge.
+    std::vector<uint64_t> edgebest(t.edges.size(), ~0ULL);
+    uint64_t overhead = ~0ULL;
+    for (int r=0; r<runs/10; r++) {
+      uint64_t c0 = cycles();
+      uint64_t c1 = cycles();
+      if (c1 - c0 < overhead) overhead = c1 - c0;
+      irDecoder bd;
+      for (size_t i=0; i<t.edges.size(); i++) {
+        c0 = cycles();
+        sink += feed(bd, t.edges[i], &ignored);
+        c1 = cycles();
+        if (c1 - c0 < edgebest[i]) edgebest[i] = c1 - c0;
+      }
+    }
+    uint64_t worst = 0;
+    for (auto c : edgebest) if (c > overhead && c - overhead > worst) worst = c - overhead;
+
+    printf("  %.1f %s per edge (average), %llu %s worst edge\n",
+      (double)best / t.edges.size(), CYCLE_UNIT, (unsigned long long)worst, CYCLE_UNIT);
+  }
+  return 0;
+}
@@ -0,0 +1,317 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Simulated OSDP card readers on a pseudo-terminal, for trying the controller code in
+// osdpProtocol.h on Linux without RS-485 hardware.
+//
+// Build and run on a PC (not part of the Arduino sketch):
+//   g++ -O2 -o osdp_sim extras/osdp_sim/osdp_sim.cpp
+//
+//   ./osdp_sim             self test: simulated readers on one side of a pty, the same
+//                          controller the sketch runs on the other; a card and a PIN
+//                          are sent and must come through.  Exits 0 if they do.
+//   ./osdp_sim reader [n]  just the n simulated readers (addresses 0..n-1), printing the
+//                          pty to connect to.  Type "card <addr> <facility> <number>" or
+//                          "keys <addr> <keys>" to send a 26-bit card or keypresses.
+//   ./osdp_sim poll <tty> [n]   just the controller, polling readers 0..n-1 on <tty>
+//                          (a USB RS-485 adapter, or the pty from "reader").
+
+#include "../../osdpProtocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <string>
+#include <deque>
+#include <vector>
+
+static uint32_t millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void makeRaw(int fd) {
+  termios t;
+  if (tcgetattr(fd, &t) == 0) {
+    cfmakeraw(&t);
+    cfsetspeed(&t, B115200);
+    tcsetattr(fd, TCSANOW, &t);
+  }
+}
+
+// Reads whatever has arrived into the ring
+static void fill(int fd, osdpRing &ring) {
+  uint8_t buf[64];
+  ssize_t n = read(fd, buf, sizeof(buf));
+  for (ssize_t i=0; i<n; i++) ring.put(buf[i]);
+}
+
+
+// ---- Simulated readers ----
+
+struct simReader {
+  uint8_t seq = 0;       // the sequence number expected next, 0 after a restart
+  std::deque<std::vector<uint8_t>> replies;  // RAW and KEYPAD replies waiting for a poll
+};
+
+static void queueCard(simReader &r, uint32_t facility, uint32_t number) {
+  // 26-bit H10301: even parity, 8-bit facility, 16-bit number, odd parity
+  uint32_t fields = ((facility & 0xFF) << 16) | (number & 0xFFFF);
+  uint32_t even = __builtin_parity(fields >> 12);
+  uint32_t odd = !__builtin_parity(fields & 0xFFF);
+  uint32_t bits = (even << 25) | (fields << 1) | odd;
+  std::vector<uint8_t> d = { 0, 0, 26, 0 };  // reader 0, raw format, 26 bits
+  bits <<= 6;  // first bit to the top of the first byte
+  for (int i=0; i<4; i++) d.push_back(bits >> (24 - 8 * i));
+  d.push_back(OSDP_RAW);  // the reply code goes last here, and is taken off when sent
+  r.replies.push_back(d);
+}
+
+static void queueKeys(simReader &r, const char *keys) {
+  std::vector<uint8_t> d = { 0, (uint8_t)strlen(keys) };
+  for (const char *k = keys; *k; k++) d.push_back(*k);
+  d.push_back(OSDP_KEYPAD);
+  r.replies.push_back(d);
+}
+
+static void reply(int fd, uint8_t addr, uint8_t seq, uint8_t code, const uint8_t *data, uint8_t n) {
+  uint8_t out[128];
+  uint8_t length = osdpBuildPacket(out, addr | OSDP_REPLY, seq, code, data, n);
+  if (write(fd, out, length) != length) perror("write");
+}
+
+// Answers one command from the controller
+static void answer(int fd, std::vector<simReader> &readers, const osdpRing &ring, const osdpPacket &p) {
+  if (p.addr & OSDP_REPLY || p.addr >= readers.size()) return;
+  simReader &r = readers[p.addr];
+  if (p.seq != 0 && p.seq != r.seq) {
+    uint8_t error = 4;  // sequence number error
+    reply(fd, p.addr, p.seq, OSDP_NAK, &error, 1);
+    return;
+  }
+  r.seq = p.seq % 3 + 1;
+
+  switch (p.code) {
+  case OSDP_POLL:
+    if (!r.replies.empty()) {
+      std::vector<uint8_t> d = r.replies.front();
+      r.replies.pop_front();
+      uint8_t code = d.back();
+      d.pop_back();
+      reply(fd, p.addr, p.seq, code, d.data(), d.size());
+      return;
+    }
+    break;
+  case OSDP_ID: {
+    uint8_t id[12] = { 0x5A, 0x5A, 0x5A, 1, 1, 0x78, 0x56, 0x34, 0x12, 1, 0, 0 };
+    reply(fd, p.addr, p.seq, OSDP_PDID, id, sizeof(id));
+    return;
+  }
+  case OSDP_LED:
+    printf("reader %d: LED colour %d\n", p.addr, ring.at(p.data + 12));
+    break;
+  case OSDP_BUZ:
+    printf("reader %d: beep\n", p.addr);
+    break;
+  }
+  reply(fd, p.addr, p.seq, OSDP_ACK, NULL, 0);
+}
+
+static void command(std::vector<simReader> &readers, const char *line) {
+  unsigned addr, facility, number;
+  char keys[64];
+  if (sscanf(line, "card %u %u %u", &addr, &facility, &number) == 3 && addr < readers.size()) {
+    queueCard(readers[addr], facility, number);
+  } else if (sscanf(line, "keys %u %63s", &addr, keys) == 2 && addr < readers.size()) {
+    queueKeys(readers[addr], keys);
+  } else printf("? card <addr> <facility> <number> | keys <addr> <keys>\n");
+}
+
+static void runReaders(int fd, int count, bool interactive) {
+  std::vector<simReader> readers(count);
+  osdpRing ring;
+  if (!interactive) {
+    queueCard(readers[0], 12, 34567);
+    queueKeys(readers[count - 1], "1234#");
+  }
+  for (;;) {
+    pollfd fds[2] = { { fd, POLLIN, 0 }, { 0, POLLIN, 0 } };
+    if (poll(fds, interactive ? 2 : 1, 1000) < 0) return;
+    if (fds[0].revents & POLLIN) fill(fd, ring);
+    if (fds[0].revents & (POLLHUP | POLLERR)) return;
+    if (interactive && (fds[1].revents & POLLIN)) {
+      char line[128];
+      if (!fgets(line, sizeof(line), stdin)) return;
+      command(readers, line);
+    }
+    osdpPacket p;
+    while (osdpNextPacket(ring, p)) {
+      answer(fd, readers, ring, p);
+      ring.consume(p.length);
+    }
+    fflush(stdout);
+  }
+}
+
+
+// ---- The controller, as osdp::loop() runs it ----
+
+struct pollResult {
+  uint32_t card = 0;
+  std::string keys;
+};
+
+static pollResult runController(int fd, int count, uint32_t runMs) {
+  osdpRing ring;
+  osdpController controller;
+  pollResult result;
+  uint32_t start = millis();
+  controller.begin(count, start);
+  controller.setLed(OSDP_GREEN);
+  uint32_t polls = 0;
+
+  while (runMs == 0 || millis() - start < runMs) {
+    pollfd pfd = { fd, POLLIN, 0 };
+    poll(&pfd, 1, 5);
+    if (pfd.revents & POLLIN) fill(fd, ring);
+    uint32_t now = millis();
+
+    osdpPacket p;
+    osdpEvent ev = {};
+    while (osdpNextPacket(ring, p)) {
+      switch (controller.reply(ring, p, now, ev)) {
+      case OSDP_EVENT_CARD: {
+        uint32_t bits = 0;
+        for (uint8_t i=0; i<4 && i<ev.length; i++) bits = (bits << 8) | ring.at(ev.data + i);
+        bits >>= 32 - ev.bits;
+        printf("reader %d: %d-bit card %08x", controller.readers[ev.reader].addr, ev.bits, bits);
+        if (ev.bits == 26) {
+          printf(" (facility %u, number %u)", (bits >> 17) & 0xFF, (bits >> 1) & 0xFFFF);
+          result.card = (bits >> 1) & 0xFFFFFF;
+        }
+        printf("\n");
+        controller.beep(ev.reader);
+        break;
+      }
+      case OSDP_EVENT_KEYS:
+        printf("reader %d: keys ", controller.readers[ev.reader].addr);
+        for (uint8_t i=0; i<ev.length; i++) {
+          uint8_t k = osdpKey(ring.at(ev.data + i));
+          char c = k < 10 ? '0' + k : k == 10 ? '*' : k == 11 ? '#' : '?';
+          putchar(c);
+          result.keys += c;
+        }
+        printf("\n");
+        controller.beep(ev.reader);
+        break;
+      case OSDP_EVENT_ONLINE:
+        printf("reader %d: online\n", controller.readers[ev.reader].addr);
+        break;
+      }
+      ring.consume(p.length);
+    }
+    if (controller.timeout(now, ev) == OSDP_EVENT_OFFLINE) {
+      printf("reader %d: offline\n", controller.readers[ev.reader].addr);
+    }
+
+    uint8_t out[OSDP_MAX_COMMAND];
+    uint8_t n = controller.poll(now, out);
+    if (n) {
+      polls++;
+      if (write(fd, out, n) != n) perror("write");
+    }
+    fflush(stdout);
+  }
+
+  for (int i=0; i<controller.count; i++) {
+    osdpReader &r = controller.readers[i];
+    printf("reader %d: %u polls, %u replies, %u timeouts, %u NAKs\n",
+           r.addr, r.polls, r.replies, r.timeouts, r.naks);
+  }
+  return result;
+}
+
+
+static int openPty(std::string &name) {
+  int fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (fd < 0 || grantpt(fd) || unlockpt(fd)) {
+    perror("pty");
+    exit(2);
+  }
+  name = ptsname(fd);
+  makeRaw(fd);
+  return fd;
+}
+
+int main(int argc, char **argv) {
+  if (argc >= 2 && !strcmp(argv[1], "reader")) {
+    int count = argc >= 3 ? atoi(argv[2]) : 1;
+    std::string name;
+    int fd = openPty(name);
+    // Keep the pty open from this side too, so it survives the controller closing it
+    int keep = open(name.c_str(), O_RDWR | O_NOCTTY);
+    makeRaw(keep);
+    printf("%d simulated OSDP reader(s) on %s\n", count, name.c_str());
+    fflush(stdout);
+    runReaders(fd, count, true);
+    close(keep);
+    return 0;
+  }
+
+  if (argc >= 3 && !strcmp(argv[1], "poll")) {
+    int fd = open(argv[2], O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
+      perror(argv[2]);
+      return 2;
+    }
+    makeRaw(fd);
+    runController(fd, argc >= 4 ? atoi(argv[3]) : 1, 0);
+    return 0;
+  }
+
+  // Self test
+  const int count = 2;
+  std::string name;
+  int master = openPty(name);
+  int slave = open(name.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (slave < 0) {
+    perror(name.c_str());
+    return 2;
+  }
+  makeRaw(slave);
+
+  pid_t child = fork();
+  if (child == 0) {
+    close(slave);
+    runReaders(master, count, false);
+    _exit(0);
+  }
+  close(master);
+  pollResult r = runController(slave, count, 1500);
+  kill(child, SIGTERM);
+  waitpid(child, NULL, 0);
+
+  bool ok = r.card == ((12u << 16) | 34567u) && r.keys == "1234#";
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
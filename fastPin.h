@@ -0,0 +1,81 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <Arduino.h>
+
+
+// A GPIO pin fixed at compile time.  Where digitalWrite() looks up the port and mask
+// in flash and guards the write with interrupts off on every call, these compile to
+// a single sbi/cbi instruction on ports A-G.  Ports H-L sit above the range sbi/cbi
+// can reach, so their writes are read-modify-write with interrupts off.
+//
+// PIN_ADDR is the data space address of the port's PINx register; DDRx and PORTx
+// follow it.  (&PINx isn't a constant expression, so the addresses are spelled out.)
+
+#define FASTPIN_PORTA 0x20
+#define FASTPIN_PORTB 0x23
+#define FASTPIN_PORTC 0x26
+#define FASTPIN_PORTD 0x29
+#define FASTPIN_PORTE 0x2C
+#define FASTPIN_PORTF 0x2F
+#define FASTPIN_PORTG 0x32
+#define FASTPIN_PORTH 0x100
+#define FASTPIN_PORTJ 0x103
+#define FASTPIN_PORTK 0x106
+#define FASTPIN_PORTL 0x109
+
+template <uint16_t PIN_ADDR, uint8_t BIT>
+struct fastPin {
+  static const uint8_t mask = 1 << BIT;
+
+  static inline volatile uint8_t &pinReg() { return *(volatile uint8_t *)PIN_ADDR; }
+  static inline volatile uint8_t &ddrReg() { return *(volatile uint8_t *)(PIN_ADDR + 1); }
+  static inline volatile uint8_t &portReg() { return *(volatile uint8_t *)(PIN_ADDR + 2); }
+
+  static inline void setBits(volatile uint8_t &reg, bool on) {
+    if (PIN_ADDR + 2 < 0x40) {
+      if (on) reg |= mask;
+      else reg &= ~mask;
+    } else {
+      uint8_t oldSREG = SREG;
+      cli();
+      if (on) reg |= mask;
+      else reg &= ~mask;
+      SREG = oldSREG;
+    }
+  }
+
+  static inline void high() { setBits(portReg(), true); }
+  static inline void low() { setBits(portReg(), false); }
+  static inline void write(bool level) { setBits(portReg(), level); }
+  static inline bool read() { return pinReg() & mask; }
+
+  // From inputPullup(), PORT is already high, so the line goes from pulled up to
+  // driven high without a dip.
+  static inline void output() { setBits(ddrReg(), true); }
+  static inline void inputPullup() {
+    setBits(ddrReg(), false);
+    setBits(portReg(), true);
+  }
+};
+
+// Pins the translation options use
+typedef fastPin<FASTPIN_PORTJ, 1> fastPin14;
+typedef fastPin<FASTPIN_PORTJ, 0> fastPin15;
+typedef fastPin<FASTPIN_PORTF, 0> fastPinA0;
+typedef fastPin<FASTPIN_PORTF, 1> fastPinA1;
@@ -0,0 +1,366 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <stdint.h>
+
+// The infrared decoders, separated from the Timer5 capture code in irMega48.cpp
+// so they can also be compiled on a PC (see extras/irbench).
+//
+// Every edge is run through all of the protocol state machines below.  Each one
+// drops back to idle as soon as an edge doesn't fit its protocol, so most of them
+// are idle at any moment.
+//
+// Times are in Timer5 ticks: 16MHz / 64 prescaler = 250KHz, so 4us per tick.
+// Every comparison is against a compile-time tick constant, and nothing on the
+// per-edge path loops or does a variable-length shift, so the cost of an edge is fixed.
+//
+// Whatever the protocol, a message comes out in the layout NEC remotes use:
+// a 16-bit address in the upper 16 bits, then ~CMDID, then CMDID in the low byte.
+// Protocols other than NEC have their addresses tagged so that, for example, a Sony
+// TV and a Philips TV don't look like the same remote to the quick-learn feature.
+
+#define IR_TICKS(us) ((uint16_t)((us) / 4))
+
+// An NEC or Samsung word that goes silent for this long is abandoned.
+#define IR_WORD_TIMEOUT_TICKS IR_TICKS(10000)
+// An RC5 frame is over (or abandoned) this long after its last edge.
+#define IR_RC5_TIMEOUT_TICKS IR_TICKS(2400)
+// A Sony SIRC frame is over (or abandoned) this long after its last edge.
+#define IR_SIRC_TIMEOUT_TICKS IR_TICKS(3000)
+
+// A repeat window with less than this left is closed early rather than timed.
+#define IR_WINDOW_SLACK_TICKS IR_TICKS(100)
+
+// Protocols that repeat whole frames while a key is held: the same frame again
+// within this time is a repeat, not a new keypress.
+#define IR_FRAME_REPEAT_TICKS IR_TICKS(150000)
+
+// Address tags for protocols other than NEC.  The protocol's own address is or'ed in.
+#define IR_TAG_RC5    0xC500
+#define IR_TAG_SIRC12 0x5100
+#define IR_TAG_SIRC15 0x5200
+#define IR_TAG_SIRC20 0x6000
+
+// Returned by edge() and timeout() when a full 32-bit message is in .message
+#define IR_GOT_MESSAGE 32
+// Returned by edge() and timeout() when a "button held down" repeat is received
+#define IR_GOT_REPEAT 1
+
+
+static inline uint32_t irNormalize(uint16_t addr, uint8_t cmd) {
+  return ((uint32_t)addr << 16) | ((uint16_t)(uint8_t)~cmd << 8) | cmd;
+}
+
+
+// NEC, extended NEC (16-bit address) and Samsung (4.5ms leading mark, address byte
+// sent twice instead of inverted).  All are 32 bits sent as pulse-distance.
+struct irNecDecoder {
+
+  // 0 = idle, 1 = got the leading mark, 2 = receiving data bits
+  uint8_t inword = 0;
+  uint8_t bitsreceived = 0;
+  // Leading mark was about 4.5ms (Samsung) rather than 9ms (NEC)
+  bool samsung = false;
+  uint32_t capbuf = 0;
+
+  // The last completed word, arranged as MFGID ~MFGID (upper 16 bits), CMDID ~CMDID
+  // (lower 16 bits), the same layout lcdMenus has always read.
+  uint32_t message = 0;
+
+  // repeatWindow is true when a repeat code would be believed.
+  inline uint8_t edge(bool fall, uint16_t ticks, bool repeatWindow) {
+
+    if (!fall) {
+      // Rises end a mark, so ticks is the length of the mark:
+      // ~9000us for a sync mark, ~4500us on Samsung remotes, ~560us for a data mark.
+      // Rises can come short of expected in case of low light/contrast.
+      if (ticks > IR_TICKS(11000)) inword = 0;
+      else if (inword == 1) samsung = ticks < IR_TICKS(6500);
+      else if (inword == 2 && (ticks < IR_TICKS(300) || ticks > IR_TICKS(950))) inword = 0;
+      return 0;
+    }
+
+    // Falls end a space, so ticks is the length of the space.
+    if (inword == 0 || ticks >= IR_TICKS(30000)) {
+      // first edge of a message
+      inword = 1;
+      bitsreceived = 0;
+      return 0;
+    }
+
+    if (inword == 1) {
+      // expecting about 4500 after the leading mark, or 2250 for a repeat.
+      if (ticks > IR_TICKS(4000) && ticks < IR_TICKS(5000)) {
+        inword = 2;
+        capbuf = 0;
+        return 0;
+      }
+      inword = 0;
+      if (ticks > IR_TICKS(2000) && ticks < IR_TICKS(2500) && repeatWindow && !samsung) return IR_GOT_REPEAT;
+      return 0;
+    }
+
+    // Receiving data: expecting a space of around 562.5 for a 0 bit, or 1687.5 for a 1 bit.
+    // Look for anything deviating from that, cancelling our word if so.
+    if (ticks < IR_TICKS(400) || ticks > IR_TICKS(1880) ||
+        (ticks > IR_TICKS(800) && ticks < IR_TICKS(1400))) {
+      inword = 0;
+      return 0;
+    }
+
+    // Bits arrive LSB first, so shift them in from the top.
+    capbuf >>= 1;
+    if (ticks > IR_TICKS(1000)) capbuf |= 0x80000000UL;
+    if (++bitsreceived != 32) return 0;
+
+    // capbuf is now ~CMDID CMDID ~MFGID MFGID from the top down.  Swap its halves.
+    message = (capbuf << 16) | (capbuf >> 16);
+    inword = 0;
+    return IR_GOT_MESSAGE;
+  }
+
+  inline bool active() { return inword != 0; }
+
+  inline void timeout() {
+    inword = 0;
+  }
+};
+
+
+// Philips RC5: 14 Manchester-coded bits of 1778us, each half mark or space.
+// A 1 is a space then a mark, a 0 a mark then a space.  The frame starts with a 1,
+// so the first fall is halfway through the first bit.
+struct irRc5Decoder {
+
+  // Half-bits received so far, 0 = idle.  Done at 28.
+  uint8_t halves = 0;
+  // The first half of the bit in progress was a mark
+  bool pendingMark = false;
+  // S1 S2 T A4..A0 C5..C0, first bit received in bit 13
+  uint16_t bits = 0;
+
+  inline bool active() { return halves != 0; }
+
+  // Adds one half-bit; false if it breaks the Manchester coding.
+  inline bool addHalf(bool mark) {
+    if (halves & 1) {
+      if (pendingMark == mark) return false;
+      bits = (bits << 1) | mark;
+    } else pendingMark = mark;
+    halves++;
+    return true;
+  }
+
+  inline uint8_t edge(bool fall, uint16_t ticks) {
+    if (halves == 0) {
+      if (fall) halves = 1, pendingMark = false, bits = 0;
+      return 0;
+    }
+
+    // Falls end a space, rises end a mark.  Each lasts one or two half-bits
+    // (889us or 1778us), with room for the receiver stretching marks.
+    bool mark = !fall;
+    uint8_t n = 0;
+    if (ticks >= IR_TICKS(640) && ticks <= IR_TICKS(1140)) n = 1;
+    else if (ticks >= IR_TICKS(1400) && ticks <= IR_TICKS(2200)) n = 2;
+
+    if (n == 0 || !addHalf(mark) || (n == 2 && halves != 28 && !addHalf(mark))) {
+      // Not RC5.  A fall might still be the start of a frame.
+      halves = fall, pendingMark = false, bits = 0;
+      return 0;
+    }
+    if (halves != 28) return 0;
+    halves = 0;
+    return IR_GOT_MESSAGE;
+  }
+
+  // A frame ending in a 0 bit ends with a mark half; the final space half has no edge.
+  inline uint8_t timeout() {
+    uint8_t h = halves;
+    halves = 0;
+    if (h == 27 && pendingMark) {
+      bits <<= 1;
+      return IR_GOT_MESSAGE;
+    }
+    return 0;
+  }
+
+  // The 6-bit command gets bit 6 from the inverted S2 ("field") bit.  The toggle bit
+  // is left out: it is for telling keypresses apart, which irDecoder does itself.
+  inline uint32_t result() {
+    uint8_t cmd = (bits & 0x3F) | ((bits & 0x1000) ? 0 : 0x40);
+    return irNormalize(IR_TAG_RC5 | ((bits >> 6) & 0x1F), cmd);
+  }
+};
+
+
+// Sony SIRC: a 2.4ms leading mark, then 12, 15 or 20 bits sent LSB first as marks of
+// 600us (0) or 1200us (1), each followed by a 600us space.  The length of the frame
+// is only known when it goes quiet.
+struct irSircDecoder {
+
+  // 0 = idle, 1 = got the leading fall, 2 = receiving bits
+  uint8_t state = 0;
+  uint8_t nbits = 0;
+  uint32_t mask = 0;
+  uint32_t bits = 0;
+
+  inline bool active() { return state != 0; }
+
+  inline uint8_t edge(bool fall, uint16_t ticks) {
+    if (fall) {
+      // A space between bits is 600us, minus what the receiver stretches marks by.
+      if (state == 2 && ticks >= IR_TICKS(350) && ticks <= IR_TICKS(900)) return 0;
+      state = 1;
+      return 0;
+    }
+    if (state == 1) {
+      if (ticks >= IR_TICKS(2000) && ticks <= IR_TICKS(2900)) {
+        state = 2, nbits = 0, mask = 1, bits = 0;
+      } else state = 0;
+      return 0;
+    }
+    if (state != 2) return 0;
+    if (ticks >= IR_TICKS(950) && ticks <= IR_TICKS(1500)) bits |= mask;
+    else if (ticks < IR_TICKS(400) || ticks > IR_TICKS(900)) state = 0;
+    mask <<= 1;
+    if (++nbits > 20) state = 0;
+    return 0;
+  }
+
+  inline uint8_t timeout() {
+    uint8_t s = state;
+    state = 0;
+    if (s != 2) return 0;
+    return (nbits == 12 || nbits == 15 || nbits == 20) ? IR_GOT_MESSAGE : 0;
+  }
+
+  inline uint32_t result() {
+    uint8_t cmd = bits & 0x7F;
+    if (nbits == 12) return irNormalize(IR_TAG_SIRC12 | ((bits >> 7) & 0x1F), cmd);
+    if (nbits == 15) return irNormalize(IR_TAG_SIRC15 | ((bits >> 7) & 0xFF), cmd);
+    return irNormalize(IR_TAG_SIRC20 | ((bits >> 7) & 0x1FFF), cmd);
+  }
+};
+
+
+// Runs all the protocol decoders over the same edges.
+struct irDecoder {
+
+  irNecDecoder nec;
+  irRc5Decoder rc5;
+  irSircDecoder sirc;
+
+  // The last completed message, in the NEC layout described at the top.
+  uint32_t message = 0;
+
+  // Ticks since the last good message or repeat, saturating at 0xFFFF (262ms).
+  // A repeat is only believed if it comes within that window.
+  uint16_t sinceMessage = 0xFFFF;
+
+  // Ticks since the last edge, saturating
+  uint16_t sinceEdge = 0;
+
+  // For protocols that repeat whole frames, the raw frame last reported, 0 for none
+  uint32_t lastFrame = 0;
+
+  // Handle one edge of the IR receiver output, which idles high and goes low during
+  // each burst of IR.  fall is true for a falling edge.  ticks is the time since the
+  // previous edge or timeout() call.  Returns 0, IR_GOT_REPEAT or IR_GOT_MESSAGE.
+  inline uint8_t edge(bool fall, uint16_t ticks) {
+
+    addTime(ticks);
+
+    // The protocols want the time since the previous edge, timeouts or not.
+    uint16_t len = sinceEdge + ticks;
+    if (len < ticks) len = 0xFFFF;
+    sinceEdge = 0;
+
+    uint8_t n = nec.edge(fall, len, sinceMessage != 0xFFFF);
+    uint8_t r = rc5.edge(fall, len);
+    uint8_t s = sirc.edge(fall, len);
+
+    if (n == IR_GOT_REPEAT) {
+      sinceMessage = 0;
+      return IR_GOT_REPEAT;
+    }
+    // Samsung remotes resend the whole word while a key is held.
+    if (n) return finish(nec.message, nec.samsung ? nec.message : 0);
+    if (r) return finish(rc5.result(), rc5.bits);
+    if (s) return finish(sirc.result(), sirc.bits | ((uint32_t)sirc.nbits << 24));
+    return 0;
+  }
+
+  // How many ticks after the last edge (or timeout) the decoder next needs timeout()
+  // called, if no edge arrives first.  0 means never: the decoder is idle and ticks
+  // handed to the next edge() don't matter.  A caller honoring this never needs
+  // to measure more than 0xFFFF ticks between calls.
+  inline uint16_t nextTimeout() {
+    // The soonest deadline of the protocols still receiving.  RC5's is shortest,
+    // then SIRC's, then NEC's.
+    uint16_t due = 0;
+    if (nec.active()) due = IR_WORD_TIMEOUT_TICKS;
+    if (sirc.active()) due = IR_SIRC_TIMEOUT_TICKS;
+    if (rc5.active()) due = IR_RC5_TIMEOUT_TICKS;
+    uint16_t wait = due ? due - sinceEdge : 0;
+
+    if (sinceMessage == 0xFFFF) return wait;
+    uint16_t left = 0xFFFF - sinceMessage;
+    if (left < IR_WINDOW_SLACK_TICKS) {
+      sinceMessage = 0xFFFF; // close the repeat window now
+      return wait;
+    }
+    return (wait == 0 || left < wait) ? left : wait;
+  }
+
+  // Called when the time asked for by nextTimeout() has passed without an edge.
+  // Ends or abandons frames that have gone quiet, and ages the repeat window.
+  // Returns 0, IR_GOT_REPEAT or IR_GOT_MESSAGE.
+  inline uint8_t timeout(uint16_t ticks) {
+    addTime(ticks);
+    uint16_t e = sinceEdge + ticks;
+    if (e < ticks) e = 0xFFFF;
+    sinceEdge = e;
+
+    if (nec.active() && e >= IR_WORD_TIMEOUT_TICKS) nec.timeout();
+    if (rc5.active() && e >= IR_RC5_TIMEOUT_TICKS && rc5.timeout()) return finish(rc5.result(), rc5.bits);
+    if (sirc.active() && e >= IR_SIRC_TIMEOUT_TICKS && sirc.timeout())
+      return finish(sirc.result(), sirc.bits | ((uint32_t)sirc.nbits << 24));
+    return 0;
+  }
+
+private:
+  inline void addTime(uint16_t ticks) {
+    uint16_t s = sinceMessage + ticks;
+    if (s < ticks) s = 0xFFFF;
+    sinceMessage = s;
+  }
+
+  // frame is the raw frame for protocols that repeat whole frames while a key is
+  // held (including RC5's toggle bit, which changes on each new keypress), or 0.
+  inline uint8_t finish(uint32_t msg, uint32_t frame) {
+    if (frame != 0 && frame == lastFrame && sinceMessage < IR_FRAME_REPEAT_TICKS) {
+      sinceMessage = 0;
+      return IR_GOT_REPEAT;
+    }
+    lastFrame = frame;
+    message = msg;
+    sinceMessage = 0;
+    return IR_GOT_MESSAGE;
+  }
+};
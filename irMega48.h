@@ -17,9 +17,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
 
-// A specialized fork of chipguyhere/PulseCapture that has been
-// reduced to the single purpose of taking over Timer5 and using it to capture NEC
-// infrared remote signals on pin 48
+// Takes over Timer5 and uses it to capture infrared remote signals on pin 48.
+// NEC, extended NEC, Samsung, Philips RC5 and Sony SIRC remotes are understood.
+// The decoding itself is in irDecode.h.
 
 struct irNEC {
   uint16_t addr_id;
@@ -38,8 +38,10 @@ public:
 	int begin();
 	
 	// Reads the most recent IR message, which can be up to 32 bits.
-	// The 32 bits might typically be 4 8-bit values: MFGID ~MFGID CMDID ~CMDID
-	// but transmitted LSB first (so may require reversal)
+	// Whatever the protocol, the upper 16 bits are the address (for NEC, MFGID and ~MFGID)
+	// and the lower 16 bits are ~CMDID then CMDID.
+	// For protocols other than NEC, the upper 16 bits hold the remote's address
+	// with a tag for the protocol (see irDecode.h).
 	// The value 0 indicates there was no message.
 	// The value 1 indicates there was a 1-bit "repeat" message received, that signifies
 	// that a button is being held down.  This is a distinct 1-bit message sent by IR
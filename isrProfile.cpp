@@ -0,0 +1,95 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Arduino.h"
+#include "isrProfile.h"
+
+
+isrStats isrProfile::stats[ISR_SLOT_COUNT];
+
+static const char PROGMEM name0[] = "Wiegand D0 (INT3)";
+static const char PROGMEM name1[] = "Wiegand D1 (INT2)";
+static const char PROGMEM name2[] = "Timer0 COMPA (beep)";
+static const char PROGMEM name3[] = "Timer5 CAPT (IR)";
+static const char PROGMEM name4[] = "Timer5 COMPB (IR)";
+static const char PROGMEM name5[] = "I2C onReceive";
+static const char PROGMEM name6[] = "I2C onRequest";
+static const char PROGMEM name7[] = "NeoPixel show";
+static const char PROGMEM name8[] = "PCINT0 (LED mirror, readers 2-3)";
+static const char PROGMEM name9[] = "Timer3 COMPA (200us)";
+static const char PROGMEM name10[] = "Reader 1 D0 (INT4)";
+static const char PROGMEM name11[] = "Reader 1 D1 (INT5)";
+static const char PROGMEM name12[] = "Timer4 CAPT (Paxton in)";
+static const char PROGMEM name13[] = "USART1 RX (OSDP)";
+static const char PROGMEM name14[] = "PCINT2 (emergency release, A12)";
+static const char * const slotNames[ISR_SLOT_COUNT] PROGMEM = {
+  name0, name1, name2, name3, name4, name5, name6, name7, name8, name9, name10, name11, name12, name13, name14
+};
+
+
+void isrProfile::setup() {
+#ifdef ISR_PROFILING
+  // Timer1 free running in normal mode at the CPU clock.  It wraps every 4.096ms,
+  // which is far longer than any handler should take.
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10);
+  TIMSK1 = 0;
+#endif
+}
+
+
+void isrProfile::dump() {
+#ifndef ISR_PROFILING
+  Serial.println(F("ISR profiling is not compiled in (see isrProfile.h)"));
+#else
+  isrStats s[ISR_SLOT_COUNT];
+  noInterrupts();
+  memcpy(s, stats, sizeof(s));
+  interrupts();
+
+  // AVR interrupts don't nest, so the longest any one handler runs is how long
+  // it can hold off every other, including the Wiegand edges.
+  uint16_t longest = 0;
+
+  Serial.println(F("Handler: count, avg/max cycles, max latency cycles, late"));
+  for (byte i=0; i<ISR_SLOT_COUNT; i++) {
+    Serial.print((__FlashStringHelper*)pgm_read_ptr(&slotNames[i]));
+    Serial.print(F(": "));
+    Serial.print(s[i].count);
+    Serial.print(F(", "));
+    Serial.print(s[i].count ? s[i].total / s[i].count : 0);
+    Serial.print('/');
+    Serial.print(s[i].max);
+    Serial.print(F(", "));
+    if (i == ISR_SLOT_TIMER0_COMPA || i == ISR_SLOT_TIMER5_CAPT || i == ISR_SLOT_TIMER5_COMPB ||
+        i == ISR_SLOT_TIMER3_COMPA) Serial.print(s[i].maxLatency);
+    else Serial.print('-');
+    Serial.print(F(", "));
+    if (i == ISR_SLOT_WIEGAND0 || i == ISR_SLOT_WIEGAND1 || i == ISR_SLOT_READER1_D0 ||
+        i == ISR_SLOT_READER1_D1 || i == ISR_SLOT_PCINT0) Serial.println(s[i].late);
+    else Serial.println('-');
+    if (s[i].max > longest) longest = s[i].max;
+  }
+  Serial.print(F("Longest time with interrupts held off: "));
+  Serial.print(longest);
+  Serial.print(F(" cycles ("));
+  Serial.print(longest / 16);
+  Serial.println(F("us)"));
+  Serial.println(F("Latency is measured in the steps of the timer that raised the interrupt (0.5 to 4us)."));
+  Serial.println(F("Not measured: USART0 (Serial) and TWI vectors (in the Arduino core)."));
+#endif
+}
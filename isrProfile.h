@@ -0,0 +1,91 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <Arduino.h>
+
+
+// Uncomment to measure the time spent in each interrupt handler.
+// Takes over Timer1, counting CPU cycles (16MHz, no prescaler).
+// Results are printed by the ISR serial command.
+// #define ISR_PROFILING
+
+
+// One slot per instrumented handler
+enum isrSlot : uint8_t {
+  ISR_SLOT_WIEGAND0,      // INT3, pin 18
+  ISR_SLOT_WIEGAND1,      // INT2, pin 19
+  ISR_SLOT_TIMER0_COMPA,  // leftOpenBeep
+  ISR_SLOT_TIMER5_CAPT,   // IR edges
+  ISR_SLOT_TIMER5_COMPB,  // IR timeouts
+  ISR_SLOT_I2C_RECEIVE,   // Wire onReceive callback (runs inside TWI_vect)
+  ISR_SLOT_I2C_REQUEST,   // Wire onRequest callback (runs inside TWI_vect)
+  ISR_SLOT_NEOPIXEL,      // Adafruit_NeoPixel::show(), which runs with interrupts off
+  ISR_SLOT_PCINT0,        // LED mirror GPIO50, Wiegand readers 2 and 3
+  ISR_SLOT_TIMER3_COMPA,  // 200us sampler
+  ISR_SLOT_READER1_D0,    // INT4, pin 2
+  ISR_SLOT_READER1_D1,    // INT5, pin 3
+  ISR_SLOT_TIMER4_CAPT,   // Paxton receiver clock, pin 49
+  ISR_SLOT_USART1_RX,     // OSDP
+  ISR_SLOT_PCINT2,        // emergency release A11, relay mirror A12
+  ISR_SLOT_COUNT
+};
+
+struct isrStats {
+  uint16_t count;       // wraps
+  uint32_t total;       // cycles
+  uint16_t max;         // cycles
+  uint16_t maxLatency;  // cycles from the hardware event to handler entry, where known
+  uint16_t late;        // Wiegand only: a whole pulse went by before the handler ran
+};
+
+class isrProfile {
+public:
+  static void setup();
+  static void dump();
+  static isrStats stats[ISR_SLOT_COUNT];
+
+  // Closes a measurement started with ISR_PROFILE_BEGIN.  Safe outside of interrupts.
+  static inline void record(uint8_t slot, uint16_t start) {
+    uint16_t c = TCNT1 - start;
+    uint8_t oldSREG = SREG;
+    cli();
+    isrStats &s = stats[slot];
+    s.count++;
+    s.total += c;
+    if (c > s.max) s.max = c;
+    SREG = oldSREG;
+  }
+
+  static inline void latency(uint8_t slot, uint16_t cycles) {
+    if (cycles > stats[slot].maxLatency) stats[slot].maxLatency = cycles;
+  }
+};
+
+
+#ifdef ISR_PROFILING
+#define ISR_PROFILE_BEGIN(slot) uint16_t isrProfileStart = TCNT1
+#define ISR_PROFILE_END(slot) isrProfile::record(slot, isrProfileStart)
+// cycles is worked out from the timer that raised the interrupt
+#define ISR_PROFILE_LATENCY(slot, cycles) isrProfile::latency(slot, cycles)
+#define ISR_PROFILE_LATE(slot, condition) do { if (condition) isrProfile::stats[slot].late++; } while (0)
+#else
+#define ISR_PROFILE_BEGIN(slot) do {} while (0)
+#define ISR_PROFILE_END(slot) do {} while (0)
+#define ISR_PROFILE_LATENCY(slot, cycles) do {} while (0)
+#define ISR_PROFILE_LATE(slot, condition) do {} while (0)
+#endif
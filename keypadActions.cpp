@@ -0,0 +1,297 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Arduino.h"
+#include "RuggedPax.h"
+
+
+// Keypad actions switch relays (those set to relay program 47) from keys on a reader's
+// keypad: *, #, bell, or a sequence of up to four keys such as #42.  The actions are a
+// table in EEPROM, set with KEYn= on the serial port or 7827xsss on the IR remote.
+//
+// Keys that make up an action never reach the ACU.  A key that could be the start of
+// a longer action is held back until the action is complete; if another key breaks
+// the sequence, or none comes for 3 seconds, the keys held back are sent on in order
+// (unless they make up a shorter action themselves, which then runs).
+
+#define KEY_ACTIONS 8
+#define KEY_SEQUENCE_MAX 4
+#define KEY_SEQUENCE_TIMEOUT_MS 3000
+#define KEY_NONE 0xF
+
+enum { actionPulse, actionToggle, actionLatch };
+
+// As stored in EEPROM.  An erased entry has no keys, so does nothing.
+struct keyAction {
+  byte keys[2];     // up to four keys, a nibble each from the top, ended by KEY_NONE
+  byte relayMode;   // relay index (0-3) in the low nibble, action in the high nibble
+  byte seconds;     // how long a pulse lasts
+};
+
+static keyAction actions[KEY_ACTIONS];
+static bool feature_enabled;
+static byte actionRelays;   // relays set to program 47, one bit each
+static byte latched;        // relays latched on until the next key
+
+static byte held[KEY_SEQUENCE_MAX];
+static byte heldCount;
+static byte heldReader;
+static byte heldAction;     // the action the held keys complete, or KEY_ACTIONS
+static softTimer holdTimer;
+
+// Keys to be sent on, the reader in the top nibble
+static byte replayQueue[8];
+static byte replayCount;
+static bool replaying;
+static softTimer replayTimer;
+
+template <byte R> static void pulseEnd() { relayPrograms::setRelay(R, false); }
+static void (* const pulseEnds[4])(void) = { pulseEnd<0>, pulseEnd<1>, pulseEnd<2>, pulseEnd<3> };
+static softTimer pulseTimers[4];
+
+
+static byte keyAt(const keyAction &a, byte i) {
+  byte b = a.keys[i/2];
+  return (i & 1) ? (b & 0x0F) : (b >> 4);
+}
+
+static byte lengthOf(const keyAction &a) {
+  byte n = 0;
+  while (n < KEY_SEQUENCE_MAX && keyAt(a, n) != KEY_NONE) n++;
+  return n;
+}
+
+static bool usable(const keyAction &a) {
+  return lengthOf(a) && (actionRelays & (1 << (a.relayMode & 0x0F)));
+}
+
+// Returns the action the held keys complete, or KEY_ACTIONS if none, and sets
+// *prefix if they are the start of a longer one.
+static byte match(bool *prefix) {
+  *prefix = false;
+  byte found = KEY_ACTIONS;
+  for (byte i=0; i<KEY_ACTIONS; i++) {
+    const keyAction &a = actions[i];
+    if (!usable(a)) continue;
+    byte len = lengthOf(a);
+    if (len < heldCount) continue;
+    byte k = 0;
+    while (k < heldCount && keyAt(a, k) == held[k]) k++;
+    if (k < heldCount) continue;
+    if (len == heldCount) {
+      if (found == KEY_ACTIONS) found = i;
+    } else {
+      *prefix = true;
+    }
+  }
+  return found;
+}
+
+static void run(const keyAction &a) {
+  byte r = a.relayMode & 0x0F;
+  switch (a.relayMode >> 4) {
+  case actionPulse:
+    relayPrograms::setRelay(r, true);
+    pulseTimers[r].start(1000UL * a.seconds, pulseEnds[r]);
+    break;
+  case actionToggle:
+    pulseTimers[r].stop();
+    relayPrograms::setRelay(r, !relayPrograms::relayOn(r));
+    break;
+  case actionLatch:
+    pulseTimers[r].stop();
+    relayPrograms::setRelay(r, true);
+    latched |= 1 << r;
+    break;
+  }
+  Serial.print(F("Key action on relay "));
+  Serial.println(r+1);
+}
+
+
+// Sends the queued keys on to the ACU, as if their readers had just sent them
+static void replay() {
+  replaying = true;
+  for (byte i=0; i<replayCount; i++) {
+    byte frame = (replayQueue[i] & 0x0F) << 4;
+    translateWiegand::receiveFrame(replayQueue[i] >> 4, &frame, 4);
+  }
+  replayCount = 0;
+  replaying = false;
+}
+
+static void queueReplay(byte reader, byte key) {
+  if (replayCount < sizeof(replayQueue)) replayQueue[replayCount++] = (reader << 4) | key;
+  if (!replayTimer.running()) replayTimer.start(0, replay);
+}
+
+// The held keys go no further: run the action they complete, or send them on.
+static void endHold() {
+  holdTimer.stop();
+  if (heldAction < KEY_ACTIONS) run(actions[heldAction]);
+  else for (byte i=0; i<heldCount; i++) queueReplay(heldReader, held[i]);
+  heldCount = 0;
+}
+
+// Adds a key to those held back, returning true if it's part of an action.  An
+// action that is also the start of a longer one waits to see which it is.
+static bool holdKey(byte reader, byte key) {
+  held[heldCount++] = key;
+  heldReader = reader;
+  bool prefix;
+  byte a = match(&prefix);
+  if (prefix) {
+    heldAction = a;
+    holdTimer.start(KEY_SEQUENCE_TIMEOUT_MS, endHold);
+    return true;
+  }
+  if (a < KEY_ACTIONS) {
+    heldCount = 0;
+    holdTimer.stop();
+    run(actions[a]);
+    return true;
+  }
+  heldCount--;
+  return false;
+}
+
+
+static void keypadActions::setup() {
+  for (byte i=0; i<KEY_ACTIONS; i++) eepromconfig::get_key_action(i, (byte *)&actions[i]);
+  for (byte i=0; i<4; i++) {
+    if (eepromconfig::get_relayprogram(i+1) == 47) actionRelays |= 1 << i;
+  }
+  feature_enabled = (actionRelays != 0);
+}
+
+static bool keypadActions::onEvent(byte event, uint32_t value) {
+  if (!feature_enabled || replaying) return false;
+  byte key = value & 0xFF;
+  byte reader = value >> 8;
+  if (key > 12) return false;
+
+  for (byte r=0; r<4; r++) {
+    if (latched & (1 << r)) relayPrograms::setRelay(r, false);
+  }
+  latched = 0;
+
+  if (heldCount && reader != heldReader) endHold();
+  if (holdKey(reader, key)) return true;
+  if (heldCount == 0) return false;
+
+  // This key doesn't carry on from the keys held back, so they are dealt with first.
+  endHold();
+  if (holdKey(reader, key)) return true;
+  queueReplay(reader, key);
+  return true;
+}
+
+
+// Keys are written 0-9, * (or E for escape), # and B for bell.
+static byte keyFromChar(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c == '*' || c == 'E') return 10;
+  if (c == '#') return 11;
+  if (c == 'B') return 12;
+  return KEY_NONE;
+}
+
+static char keyChar(byte k) {
+  return k < 10 ? '0' + k : k == 10 ? '*' : k == 11 ? '#' : 'B';
+}
+
+static void printAction(byte n) {
+  const keyAction &a = actions[n];
+  Serial.print(F("KEY"));
+  Serial.print(n+1);
+  Serial.print('=');
+  byte len = lengthOf(a);
+  if (len == 0) {
+    Serial.println();
+    return;
+  }
+  for (byte i=0; i<len; i++) Serial.print(keyChar(keyAt(a, i)));
+  Serial.print(',');
+  Serial.print((a.relayMode & 0x0F) + 1);
+  Serial.print(',');
+  switch (a.relayMode >> 4) {
+  case actionPulse: Serial.print('P'); Serial.print(a.seconds); break;
+  case actionToggle: Serial.print('T'); break;
+  case actionLatch: Serial.print('L'); break;
+  }
+  if (!(actionRelays & (1 << (a.relayMode & 0x0F)))) Serial.print(F("  (relay isn't program 47)"));
+  Serial.println();
+}
+
+static void keypadActions::printActions() {
+  for (byte i=0; i<KEY_ACTIONS; i++) printAction(i);
+}
+
+static void keypadActions::set(byte n, const byte *keys, byte count, byte relay, byte mode, byte seconds) {
+  if (n >= KEY_ACTIONS) return;
+  keyAction a;
+  memset(&a, 0xFF, sizeof(a));
+  if (count > KEY_SEQUENCE_MAX) count = KEY_SEQUENCE_MAX;
+  for (byte i=0; i<count; i++) {
+    if (i & 1) a.keys[i/2] = (a.keys[i/2] & 0xF0) | keys[i];
+    else a.keys[i/2] = (keys[i] << 4) | 0x0F;
+  }
+  if (count) {
+    a.relayMode = (mode << 4) | (relay & 0x03);
+    a.seconds = seconds;
+  }
+  actions[n] = a;
+  eepromconfig::set_key_action(n, (const byte *)&a);
+}
+
+// KEYn=keys,relay,action where action is Pn (pulse n seconds), T (toggle)
+// or L (latch until the next key).  KEYn= alone removes the action.
+static bool keypadActions::configure(const char *cmd) {
+  if (cmd[0] < '1' || cmd[0] > '0' + KEY_ACTIONS || cmd[1] != '=') return false;
+  byte n = cmd[0] - '1';
+  const char *p = cmd + 2;
+  byte keys[KEY_SEQUENCE_MAX];
+  byte count = 0;
+  while (*p && *p != ',') {
+    byte k = keyFromChar(*p++);
+    if (k == KEY_NONE || count == KEY_SEQUENCE_MAX) return false;
+    keys[count++] = k;
+  }
+  if (count == 0) {
+    set(n, keys, 0, 0, 0, 0);
+    printAction(n);
+    return true;
+  }
+  if (*p++ != ',' || *p < '1' || *p > '4' || p[1] != ',') return false;
+  byte relay = *p - '1';
+  p += 2;
+  byte mode;
+  int seconds = 0;
+  switch (*p++) {
+  case 'P':
+    mode = actionPulse;
+    seconds = atoi(p);
+    if (seconds < 1 || seconds > 255) return false;
+    break;
+  case 'T': mode = actionToggle; break;
+  case 'L': mode = actionLatch; break;
+  default: return false;
+  }
+  set(n, keys, count, relay, mode, seconds);
+  printAction(n);
+  return true;
+}
@@ -0,0 +1,45 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Arduino.h"
+#include "RuggedPax.h"
+
+
+void latencyHistogram::add(uint32_t value) {
+  byte b = 0;
+  while (b < LATENCY_BUCKETS-1 && value >= (2UL << b)) b++;
+  if (bucket[b] < 0xFFFF) bucket[b]++;
+  if (value > max) max = value;
+  count++;
+}
+
+void latencyHistogram::print(const __FlashStringHelper *title, const __FlashStringHelper *units) {
+  Serial.print(title);
+  Serial.print(F(": "));
+  Serial.print(count);
+  Serial.print(F(" samples, max "));
+  Serial.print(max);
+  Serial.println(units);
+  for (byte b=0; b<LATENCY_BUCKETS; b++) {
+    if (bucket[b] == 0) continue;
+    Serial.print(b == LATENCY_BUCKETS-1 ? F("  >= ") : F("  < "));
+    Serial.print(b == LATENCY_BUCKETS-1 ? (1UL << b) : (2UL << b));
+    Serial.print(units);
+    Serial.print(F(": "));
+    Serial.println(bucket[b]);
+  }
+}
@@ -29,9 +29,6 @@ static Adafruit_SSD1306 display(128, 32, &Wire, -1); // 128x32 OLED display
 
 static irMega48 ir;
 
-static displayPage *firstdisplayPage=NULL;
-displayPage* diagnosticsPage;
-static displayPage programmingMode;
 static bool lcdInitSuccess=false;
 static const char keymap[] PROGMEM = "0123456789*#";
 
@@ -43,9 +40,14 @@ static void setRgbLedColor(byte r, byte g, byte b) {
   if (!inited) pixels.begin();
   inited=true;
   pixels.setPixelColor(0, pixels.Color(r,g,b));
+  ISR_PROFILE_BEGIN(ISR_SLOT_NEOPIXEL);
   pixels.show();
+  ISR_PROFILE_END(ISR_SLOT_NEOPIXEL);
 }
 
+static softTimer buttonTimer;
+static void pollButton();
+
 static void lcdMenus::setup() {
   setRgbLedColor(0, 0, 128);
   ir.begin();
@@ -67,42 +69,74 @@ static void lcdMenus::setup() {
     Serial.println(F("SSD1306 i2c display initialization failed"));
   }
 
-  // Add the screen for the programming mode
-  programmingMode.rommsg = PSTR("Programming Mode\n\n\nUse infrared remote");
-  addDisplayPage(&programmingMode);
-  
+  // Prompt shown on the programming mode screen until the first IR keypress
+  strcpy_P(pageArena.programmingMode, PSTR("\n\nUse infrared remote"));
 
-}
+  buttonTimer.every(100, pollButton);
 
-displayPage* addDisplayPage(displayPage *msg) {
-  if (firstdisplayPage==NULL) {
-    firstdisplayPage=msg;
-    return msg;    
-  }
-  displayPage *sm = firstdisplayPage;
-  while (sm->onShortPress != NULL) sm = sm->onShortPress;
-  sm->onShortPress = msg;    
-  return msg;
 }
 
-displayPage* displayPage::addDisplayPage(displayPage *msg) {
-  displayPage *sm = this;
-  while (sm->onShortPress != NULL) sm = sm->onShortPress;
-  sm->onShortPress = msg;    
-  return msg;
+pageArena_t pageArena;
+
+static const char PROGMEM programmingModeText[] = "Programming Mode\n";
+static const displayPage programmingModePage PROGMEM = { programmingModeText, pageArena.programmingMode };
+
+// The top level of the menu, stepped through with short presses.
+// Pages of modules that aren't enabled are skipped.
+static const displayPage * const mainMenuPages[] PROGMEM = {
+  &helloPage,
+  &diagnosticsModePage,
+  &programmingModePage,
+  &emergencyRelease::releasedPage,
+  &translateWiegand::menuPage,
+  &relayPrograms::menuPage,
+  &emergencyRelease::menuPage,
+  &currentSensing::menuPage,
+  &doorman::motionMenuPage,
+  &doorman::menuPage,
+  &leftOpenBeep::menuPage,
+  &doorbellButton::program8Page,
+  &doorbellButton::program9Page,
+  &doorbellButton::program18Page,
+  &doorbellButton::program19Page,
+  &doorbellButton::statusPage,
+  NULL
+};
+
+// The page being displayed (NULL for a blank screen), the PROGMEM list it
+// came from, and its position in that list.
+static const displayPage *sm;
+static const displayPage * const *smList;
+static byte smIndex;
+
+static bool pageIsShown(const displayPage *dp) {
+  const byte *showIf = (const byte*)pgm_read_ptr(&dp->showIf);
+  return showIf==NULL || *showIf == pgm_read_byte(&dp->showWhen);
 }
 
-displayPage* displayPage::addLongPressDisplayPage(displayPage *msg) {
-  displayPage *sm = this;
-  while (sm->onLongPress != NULL) sm = sm->onLongPress;
-  sm->onLongPress = msg;    
-  return msg;
+// Select the first page in the list at or after position i that isn't skipped.
+// Running off the end of the list blanks the screen.
+static void selectPage(const displayPage * const *list, byte i) {
+  sm = NULL;
+  if (list==NULL) return;
+  for (const displayPage *dp; (dp = (const displayPage*)pgm_read_ptr(&list[i])) != NULL; i++) {
+    if (pageIsShown(dp)) {
+      sm = dp, smList = list, smIndex = i;
+      return;
+    }
+  }
 }
 
 extern Watchdog watchdog;
 
 static char alreadyDisplayed[100];
-static long lastPaintdisplayPage;
+static byte splashCompleted;
+static bool letsreboot;
+
+static softTimer paintTimer;
+static softTimer heartbeatTimer;
+static softTimer heartbeatOffTimer;
+static softTimer blankTimer;
 
 // global function to prompt the display logic to update the screen ASAP
 static void lcdMenus::updateScreen() {
@@ -110,105 +144,77 @@ static void lcdMenus::updateScreen() {
   // that will quickly miscompare and force a screen redraw
   alreadyDisplayed[0]=0xFF;
   alreadyDisplayed[1]=0;
-  lastPaintdisplayPage = millis() - 2000;
 }
 
-static void lcdMenus::loop() {
-
-  // LED splash, show fade from green to blue for first second after poweron
-  static byte splashCompleted;
-  if (splashCompleted==0) {
-    uint32_t um = millis();
-    if (um > 1000) {
-      splashCompleted=1; 
-      display.clearDisplay();
-      display.setTextColor(SSD1306_WHITE);
-      display.setCursor(20, 15);
-      display.setFont(&FreeSerifBold9pt7b);
-      display.println(F("ARDUINO"));
-      display.display();      // Show initial text
-      display.setFont();
-    }
-    else setRgbLedColor(0, (byte)(um>>4), 255-(byte)(um>>3));
-  } else if (splashCompleted==1) {
-    uint32_t um = millis();
-    if (um > 2000) { splashCompleted=2; updateScreen(); }
-    else setRgbLedColor(0, (byte)(um>>4), 255-(byte)(um>>3));
-  }
-
+// Perform the blinking green light heartbeat once per second
+static void heartbeatOff() {
+  setRgbLedColor(0,0,0);
+}
 
-  long m = millis();
+static void heartbeatOn() {
+  setRgbLedColor(0, 24, 0);
+  heartbeatOffTimer.start(50, heartbeatOff);
+}
 
-  // Perform the blinking green light heartbeat once per second
-  static long lastLightOn, lastLightOff;
-  if (splashCompleted==2) {
-    if (m - lastLightOn >= 1000) {
-      setRgbLedColor(0, 24, 0);
-      lastLightOn=lastLightOff=m;
-    } else if (m - lastLightOff > 50) {
-      setRgbLedColor(0,0,0);
-      lastLightOff=m;
+// refresh displayed message
+static void paint() {
+  if (!lcdInitSuccess) return;
+  char whatToDisplay[100];
+  char *w = whatToDisplay;
+  byte n = 0;
+
+  displayPage page;
+  if (sm != NULL) memcpy_P(&page, sm, sizeof(page));
+  else memset(&page, 0, sizeof(page));
+
+  if (page.rommsg != NULL && page.arg != 0) {
+    snprintf_P(w, sizeof(whatToDisplay), page.rommsg, page.arg);
+    n = strlen(w);
+    w += n;
+  } else if (page.rommsg != NULL) {
+    const char PROGMEM *rommsg = page.rommsg;
+    while (pgm_read_byte(rommsg) && n<(sizeof(whatToDisplay)-1)) {
+      *w++ = (char)pgm_read_byte(rommsg++);
+      n++;
     }
   }
-
-  // refresh displayed message
-  static displayPage *sm;
-  static bool displayTimeoutEnabled;
-  static long lastKeyPress;
-  if ((m - lastPaintdisplayPage > 1000) && lcdInitSuccess && splashCompleted==2) {
-    char whatToDisplay[100];
-    char *w = whatToDisplay;
-    byte n = 0;
-
-    if (sm != NULL && sm->rommsg != NULL) {
-      const char PROGMEM *rommsg = sm->rommsg;
-      while (pgm_read_byte(rommsg) && n<(sizeof(whatToDisplay)-1)) {
-        *w++ = (char)pgm_read_byte(rommsg++);
-        n++;
-      }
-    }
-    if (sm != NULL && sm->msg != NULL) {
-      char *s = sm->msg;
-      while (*s && n<(sizeof(whatToDisplay)-1)) {
-        *w++ = *s++;
-        n++;
-      }
-    }
-    *w=0;
-
-    // Display has changed, so refresh it
-    if (strcmp(alreadyDisplayed, whatToDisplay) != 0) {
-      strcpy(alreadyDisplayed, whatToDisplay);
-      display.clearDisplay();
-      display.setTextColor(SSD1306_WHITE);
-      display.setCursor(0,0);
-      display.print(whatToDisplay);
-      display.display();
+  if (page.msg != NULL) {
+    char *s = page.msg;
+    while (*s && n<(sizeof(whatToDisplay)-1)) {
+      *w++ = *s++;
+      n++;
     }
   }
-  
-  m=millis();
+  *w=0;
 
-  // blank out the screen if no keypress in 5 minutes.
-  if (displayTimeoutEnabled && (m-lastKeyPress > 300000)) sm=NULL,displayTimeoutEnabled=false;
+  // Display has changed, so refresh it
+  if (strcmp(alreadyDisplayed, whatToDisplay) != 0) {
+    strcpy(alreadyDisplayed, whatToDisplay);
+    display.clearDisplay();
+    display.setTextColor(SSD1306_WHITE);
+    display.setCursor(0,0);
+    display.print(whatToDisplay);
+    display.display();
+  }
+}
 
+// blank out the screen if no keypress in 5 minutes.
+static void blankScreen() {
+  sm=NULL;
+}
 
-  // poll the button, and go to the next displayPage if it's been pressed.
-  static long lastButtonPoll;
+// poll the button, and go to the next displayPage if it's been pressed.
+static void pollButton() {
   static bool lastButtonPressed;
-  static bool letsreboot;
   static byte buttonHeldTicks;
 
   enum {none, shortPressed, longPressed} buttonEvent = none;
 
 #define LONG_BUTTONPRESS_LENGTH_TENTHS 8
 
-  bool buttonPressed = lastButtonPressed;
-  if (m - lastButtonPoll > 100) {
-    buttonPressed = (digitalRead(47)==LOW), lastButtonPoll=m;
-    // some tenths of seconds of holding is a "long press"
-    if (buttonPressed) if (++buttonHeldTicks==LONG_BUTTONPRESS_LENGTH_TENTHS) buttonEvent = longPressed;
-  }
+  bool buttonPressed = (digitalRead(47)==LOW);
+  // some tenths of seconds of holding is a "long press"
+  if (buttonPressed) if (++buttonHeldTicks==LONG_BUTTONPRESS_LENGTH_TENTHS) buttonEvent = longPressed;
   // Elsewhere in the sketch, if the button is held 8+ sec, the watchdog timer feed is skipped,
   // causing a reboot.  // if button released after not having been held, that's a "short press"
   if (lastButtonPressed==true && buttonPressed==false && buttonHeldTicks < LONG_BUTTONPRESS_LENGTH_TENTHS) buttonEvent = shortPressed;
@@ -228,29 +234,58 @@ static void lcdMenus::loop() {
 
   if (buttonEvent != none) {
     ir.read(); // flush buffer
-    displayTimeoutEnabled=true;
-    lastKeyPress=m;
-    if (sm==NULL) sm=firstdisplayPage;
-    else sm = (buttonEvent==shortPressed) ? sm->onShortPress : sm->onLongPress;
+    blankTimer.start(300000, blankScreen);
+    if (sm==NULL) selectPage(mainMenuPages, 0);
+    else if (buttonEvent==shortPressed) selectPage(smList, smIndex+1);
+    else selectPage((const displayPage * const *)pgm_read_ptr(&sm->detail), 0);
   }
+}
 
+static void lcdMenus::loop() {
 
-  static char irrxtxt[40];
+  // LED splash, show fade from green to blue for first second after poweron
+  if (splashCompleted==0) {
+    uint32_t um = millis();
+    if (um > 1000) {
+      splashCompleted=1; 
+      display.clearDisplay();
+      display.setTextColor(SSD1306_WHITE);
+      display.setCursor(20, 15);
+      display.setFont(&FreeSerifBold9pt7b);
+      display.println(F("ARDUINO"));
+      display.display();      // Show initial text
+      display.setFont();
+    }
+    else setRgbLedColor(0, (byte)(um>>4), 255-(byte)(um>>3));
+  } else if (splashCompleted==1) {
+    uint32_t um = millis();
+    if (um > 2000) {
+      splashCompleted=2;
+      updateScreen();
+      paintTimer.every(100, paint);
+      heartbeatTimer.every(1000, heartbeatOn);
+    }
+    else setRgbLedColor(0, (byte)(um>>4), 255-(byte)(um>>3));
+  }
+
+
+  char *irrxtxt = pageArena.programmingMode;
+  static bool irPromptCleared;
   static uint16_t addresscode;
   static byte totalrx0;
   static byte totalrxn;
   static byte commandcodes[12];
-  if (sm == &programmingMode) {
+  if (sm == &programmingModePage) {
     uint32_t irrx = ir.read();
     // We can either use the cheap Amazon $1 Arduino remote (ten key with blue arrows and red */#/OK)
     // SET UP THE IR RECEIVER TO LEARN A NEW REMOTE ON DEMAND.
-    // Simply press 0000000000123456789*# on any NEC-compatible remote, and the keys are displayed as learned.
+    // Simply press 0000000000123456789*# on any NEC, Samsung, RC5 or Sony remote, and the keys are displayed as learned.
     // # will be enter and * will be erase/startover.
     // If you mistake, just start over with 0's again.
     if (irrx == 0); // Nothing was pressed.
     if (irrx == 1); // A previous key is being held down, we'll ignore.
     if (irrx > 1) { // A new key was pressed.
-      programmingMode.rommsg = PSTR("Programming Mode\n"); // Removes the "Use Infrared Remote" message
+      if (!irPromptCleared) irrxtxt[0]=0, irPromptCleared=true; // Removes the "Use Infrared Remote" message
       byte c = 0xFF;
       uint16_t irrxaddr = irrx>>16;
       byte irrxcmd = irrx;
@@ -293,6 +328,13 @@ static void lcdMenus::loop() {
             letsreboot=true;
           }
 
+          // 00111xxx thru 00114xxx - RELAY MINIMUM ON-TIME, tenths of a second
+          if (ls >= 111 && ls <= 114 && rs <= 254) {
+            eepromconfig::set_relay_min_on(ls-110, rs);
+            strcpy_P(irrxtxt,PSTR("relay on-time set."));
+            letsreboot=true;
+          }
+
           // 36677 (DOORS) - DOOR OPTION
           if (ls == 36677) {
             eepromconfig::set_dooroption(rs);
@@ -321,6 +363,72 @@ static void lcdMenus::loop() {
             letsreboot=true; 
           }
 
+          // 38737xxx - DUPLICATE CARD HOLD-OFF
+          if (ls==38737) {
+            eepromconfig::set_duplicate_holdoff(rs);
+            strcpy_P(irrxtxt, PSTR("duplicate hold-off set."));
+            letsreboot=true;
+          }
+
+          // 53973xxx - PIN ENTRY
+          if (ls==53973) {
+            eepromconfig::set_pin_entry_option(rs);
+            strcpy_P(irrxtxt, PSTR("PIN entry option set."));
+            letsreboot=true;
+          }
+
+          // 73237xxx - WIEGAND READER COUNT
+          if (ls==73237) {
+            eepromconfig::set_reader_count(rs);
+            strcpy_P(irrxtxt, PSTR("reader count set."));
+            letsreboot=true;
+          }
+
+          // 67377b0n - OSDPR: OSDP readers, b = baud (0-4: 9600-115200), n = reader count (1-4), 000 off
+          if (ls==67377) {
+            byte baud = rs / 100, count = rs % 10;
+            if (rs == 0 || (baud <= 4 && (rs / 10) % 10 == 0 && count >= 1 && count <= 4)) {
+              eepromconfig::set_osdp_option(baud * 10 + count);
+              strcpy_P(irrxtxt, PSTR("OSDP option set."));
+              letsreboot=true;
+            } else {
+              strcpy_P(irrxtxt, PSTR("not an OSDP option."));
+            }
+          }
+
+          // 7827xsss - STAR: the * key pulses relay x for sss seconds (000 removes it)
+          if (ls >= 78271 && ls <= 78274 && rs <= 255) {
+            byte star = 10;
+            byte relay = ls - 78271;
+            keypadActions::set(relay, &star, rs ? 1 : 0, relay, 0, rs);
+            if (rs) eepromconfig::set_relayprogram(relay+1, 47);
+            strcpy_P(irrxtxt, PSTR("* key action set."));
+            letsreboot=true;
+          }
+
+          // 7853xbbb - RULE: adds byte bbb to relay x's rule (000 starts it over)
+          if (ls >= 78531 && ls <= 78534 && rs <= 255) {
+            byte relay = ls - 78531;
+            relayRules::append(relay, rs);
+            eepromconfig::set_relayprogram(relay+1, 48);
+            strcpy_P(irrxtxt, PSTR("relay rule updated."));
+            letsreboot=true;
+          }
+
+          // 36735xxx - EMREL: emergency release on A11
+          if (ls==36735) {
+            eepromconfig::set_emergency_release_option(rs);
+            strcpy_P(irrxtxt, PSTR("emergency release set."));
+            letsreboot=true;
+          }
+
+          // 76883xxx - ROUTE: which Paxton reader port gets each read under option 214
+          if (ls==76883) {
+            eepromconfig::set_route_option(rs);
+            strcpy_P(irrxtxt, PSTR("routing option set."));
+            letsreboot=true;
+          }
+
           // 87267xxx - TRANSLATION BEHAVIOR
           if (ls==87267) {
             eepromconfig::set_translationoption(rs);
@@ -375,7 +483,6 @@ static void lcdMenus::loop() {
         for (int i=0; i<totalrx0; i++) irrxtxt[i+7]='.';
         irrxtxt[totalrx0+7]=0;
       }
-      programmingMode.msg=irrxtxt;
     }
   }
 
@@ -0,0 +1,205 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Arduino.h"
+#include "RuggedPax.h"
+#include "osdpProtocol.h"
+#include "fastPin.h"
+
+
+// OSDP card readers on an RS-485 bus, through a transceiver on USART1: TX1 (GPIO18)
+// to its DI, RX1 (GPIO19) to its RO, and GPIO4 to its DE and ~RE.  These are reader 0's
+// Wiegand pins, which are left alone while OSDP is on.
+//
+// USART1 is driven here rather than through Serial1, so received bytes land straight
+// in the ring the packets are parsed from, and the transmitter is let go of the bus
+// (DE low) by the transmit complete interrupt, the moment the last stop bit is out.
+// Nothing in the sketch uses Serial1, so the core's USART1 handlers aren't linked in.
+//
+// Cards and keys go to translateWiegand as if they came from Wiegand reader n, where
+// n is the OSDP reader's address (0-3).
+
+typedef fastPin<FASTPIN_PORTG, 5> osdpDirection;  // GPIO4
+
+bool osdp::feature_enabled;
+static byte baudIndex;   // into bauds[], from the option (baud*10 + readers)
+
+static osdpRing rx;
+static osdpController controller;
+static uint16_t rxOverruns;   // bytes lost to a full ring
+static uint16_t rxErrors;     // framing errors and bytes lost in the UART
+
+static uint8_t tx[OSDP_MAX_COMMAND];
+static volatile uint8_t txLength;
+static volatile uint8_t txNext;
+static volatile bool sending;
+
+static bool ledWasOn;
+
+static const uint32_t bauds[] PROGMEM = { 9600, 19200, 38400, 57600, 115200 };
+
+
+ISR(USART1_RX_vect) {
+  ISR_PROFILE_BEGIN(ISR_SLOT_USART1_RX);
+  uint8_t status = UCSR1A;
+  uint8_t b = UDR1;
+  if (status & (_BV(FE1) | _BV(DOR1))) rxErrors++;
+  else if (!rx.put(b)) rxOverruns++;
+  ISR_PROFILE_END(ISR_SLOT_USART1_RX);
+}
+
+ISR(USART1_UDRE_vect) {
+  UDR1 = tx[txNext++];
+  if (txNext == txLength) UCSR1B &= ~_BV(UDRIE1);
+}
+
+ISR(USART1_TX_vect) {
+  osdpDirection::low();
+  sending = false;
+}
+
+
+static void send(uint8_t length) {
+  txLength = length;
+  txNext = 0;
+  sending = true;
+  osdpDirection::high();
+  noInterrupts();
+  UCSR1A |= _BV(TXC1);  // written as 1 to clear it
+  UCSR1B |= _BV(UDRIE1);
+  interrupts();
+}
+
+
+static void osdp::setup() {
+  byte opt = eepromconfig::get_osdp_option();
+  if (opt == 0) return;
+  byte readerCount = opt % 10;
+  baudIndex = opt / 10;
+  if (readerCount < 1 || readerCount > OSDP_MAX_READERS || baudIndex > 4) return;
+  feature_enabled = true;
+
+  osdpDirection::low();
+  osdpDirection::output();
+  pinMode(19, INPUT_PULLUP);
+
+  uint32_t baud = pgm_read_dword(&bauds[baudIndex]);
+  noInterrupts();
+  UBRR1 = (F_CPU / 8 + baud / 2) / baud - 1;
+  UCSR1A = _BV(U2X1);
+  UCSR1C = _BV(UCSZ11) | _BV(UCSZ10);  // 8N1
+  UCSR1B = _BV(RXEN1) | _BV(TXEN1) | _BV(RXCIE1) | _BV(TXCIE1);
+  interrupts();
+
+  // Readers start out green; the LED input is looked at from loop(), once
+  // translateWiegand has set it up.
+  controller.begin(readerCount, millis());
+}
+
+
+static void cardFrom(const osdpEvent &ev) {
+  byte bits[(WIEGAND_MAX_BITS + 7) / 8];
+  if (ev.bits > WIEGAND_MAX_BITS) return;
+  byte n = (ev.bits + 7) / 8;
+  for (byte i=0; i<n; i++) bits[i] = rx.at(ev.data + i);
+  translateWiegand::receiveFrame(controller.readers[ev.reader].addr, bits, ev.bits);
+}
+
+static void keysFrom(const osdpEvent &ev) {
+  for (byte i=0; i<ev.length; i++) {
+    byte key = osdpKey(rx.at(ev.data + i));
+    if (key == 0xFF) continue;
+    byte bits = key << 4;  // a 4-bit keypad message
+    translateWiegand::receiveFrame(controller.readers[ev.reader].addr, &bits, 4);
+  }
+}
+
+
+static void osdp::loop() {
+  if (!feature_enabled) return;
+  unsigned long now = millis();
+
+  osdpPacket p;
+  osdpEvent ev;
+  while (osdpNextPacket(rx, p)) {
+    switch (controller.reply(rx, p, now, ev)) {
+    case OSDP_EVENT_CARD:
+      cardFrom(ev);
+      controller.beep(ev.reader);
+      break;
+    case OSDP_EVENT_KEYS:
+      keysFrom(ev);
+      controller.beep(ev.reader);
+      break;
+    case OSDP_EVENT_ONLINE:
+      Serial.print(F("OSDP reader "));
+      Serial.print(controller.readers[ev.reader].addr);
+      Serial.println(F(" online"));
+      break;
+    }
+    rx.consume(p.length);
+  }
+
+  if (controller.timeout(now, ev) == OSDP_EVENT_OFFLINE) {
+    Serial.print(F("OSDP reader "));
+    Serial.print(controller.readers[ev.reader].addr);
+    Serial.println(F(" offline"));
+  }
+
+  // The readers' LEDs follow the Paxton's, as the LED wire of a Wiegand reader would.
+  bool ledOn = translateWiegand::ledIsOn();
+  if (ledOn != ledWasOn) {
+    ledWasOn = ledOn;
+    controller.setLed(ledOn ? OSDP_RED : OSDP_GREEN);
+  }
+
+  if (!sending) {
+    uint8_t n = controller.poll(now, tx);
+    if (n) send(n);
+  }
+}
+
+
+static void osdp::printStatus() {
+  if (!feature_enabled) {
+    Serial.println(F("OSDP is off (IR code 67377xxx)"));
+    return;
+  }
+  Serial.print(F("OSDP at "));
+  Serial.print(pgm_read_dword(&bauds[baudIndex]));
+  Serial.print(F(" baud, receive errors: "));
+  Serial.print(rxErrors);
+  Serial.print(F(", overruns: "));
+  Serial.println(rxOverruns);
+  for (byte i=0; i<controller.count; i++) {
+    osdpReader &r = controller.readers[i];
+    Serial.print(F("Reader "));
+    Serial.print(r.addr);
+    Serial.print(r.online ? F(" online") : F(" offline"));
+    Serial.print(F(", polls: "));
+    Serial.print(r.polls);
+    Serial.print(F(", replies: "));
+    Serial.print(r.replies);
+    Serial.print(F(", timeouts: "));
+    Serial.print(r.timeouts);
+    Serial.print(F(", NAKs: "));
+    Serial.print(r.naks);
+    Serial.print(F(", poll interval: "));
+    Serial.print(controller.interval(r, millis()));
+    Serial.println(F("ms"));
+  }
+}
@@ -0,0 +1,353 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <stdint.h>
+
+// OSDP (Open Supervised Device Protocol) packets, and the controller side of talking
+// to OSDP card readers on an RS-485 bus.  Kept apart from the USART1 code in osdp.cpp
+// so the same code can be run on a PC against a simulated reader (see extras/osdp_sim).
+//
+// Only what card readers need: the POLL, ID, LED and BUZ commands, and the ACK, NAK,
+// PDID, RAW (card data) and KEYPAD replies.  Packets are always sent with a CRC and
+// never use the secure channel.
+//
+// Received bytes go into an osdpRing, and packets are checked and read where they lie
+// in the ring, without being copied out of it first.
+
+#define OSDP_SOM 0x53
+#define OSDP_CTRL_CRC 0x04
+#define OSDP_CTRL_SCB 0x08
+#define OSDP_REPLY 0x80  // set in the address byte of replies
+
+// Commands
+#define OSDP_POLL 0x60
+#define OSDP_ID 0x61
+#define OSDP_LED 0x69
+#define OSDP_BUZ 0x6A
+// Replies
+#define OSDP_ACK 0x40
+#define OSDP_NAK 0x41
+#define OSDP_PDID 0x45
+#define OSDP_RAW 0x50
+#define OSDP_KEYPAD 0x53
+
+// LED colours
+#define OSDP_RED 1
+#define OSDP_GREEN 2
+
+
+// CRC-16 with polynomial 0x1021 starting from 0x1D0F, four bits at a time.
+static const uint16_t osdpCrcNibbles[16] = {
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+#define OSDP_CRC_INIT 0x1D0F
+
+static inline uint16_t osdpCrcByte(uint16_t crc, uint8_t b) {
+  crc = (crc << 4) ^ osdpCrcNibbles[(crc >> 12) ^ (b >> 4)];
+  return (crc << 4) ^ osdpCrcNibbles[(crc >> 12) ^ (b & 0x0F)];
+}
+
+
+// Received bytes.  One side (the UART receive interrupt) puts bytes in at head, the
+// other reads and consumes them at tail.  head and tail count bytes and wrap at 256.
+#define OSDP_RING_SIZE 128  // a power of two, no more than 128
+
+struct osdpRing {
+  uint8_t buf[OSDP_RING_SIZE];
+  volatile uint8_t head = 0;
+  volatile uint8_t tail = 0;
+
+  inline uint8_t count() const { return head - tail; }
+  // The i'th byte from tail
+  inline uint8_t at(uint8_t i) const { return buf[(uint8_t)(tail + i) & (OSDP_RING_SIZE - 1)]; }
+  inline void consume(uint8_t n) { tail += n; }
+  // Returns false if the ring is full and the byte was dropped
+  inline bool put(uint8_t b) {
+    uint8_t h = head;
+    if ((uint8_t)(h - tail) == OSDP_RING_SIZE) return false;
+    buf[h & (OSDP_RING_SIZE - 1)] = b;
+    head = h + 1;
+    return true;
+  }
+};
+
+
+// A whole packet at the front of the ring.  Offsets are from the ring's tail.
+struct osdpPacket {
+  uint8_t addr;        // the address byte, with OSDP_REPLY set for replies
+  uint8_t seq;
+  uint8_t code;
+  uint8_t data;        // offset of the first data byte
+  uint8_t dataLength;
+  uint8_t length;      // the whole packet, to consume() once it has been dealt with
+};
+
+// Finds the next packet at the front of the ring, throwing away anything before it
+// that isn't a packet with a good CRC or checksum.  Returns false until a whole packet
+// has arrived; it stays in the ring until the caller consumes it.
+static inline bool osdpNextPacket(osdpRing &r, osdpPacket &p) {
+  for (;;) {
+    while (r.count() && r.at(0) != OSDP_SOM) r.consume(1);
+    uint8_t have = r.count();
+    if (have < 7) return false;  // SOM ADDR LEN LEN CTRL CODE CKSUM is the shortest
+
+    uint8_t ctrl = r.at(4);
+    uint16_t length = r.at(2) | (r.at(3) << 8);
+    uint8_t header = 5 + ((ctrl & OSDP_CTRL_SCB) ? r.at(5) : 0);
+    uint8_t trailer = (ctrl & OSDP_CTRL_CRC) ? 2 : 1;
+    if (length > OSDP_RING_SIZE || length < header + 1 + trailer) {
+      r.consume(1);  // not a packet we can take; look for the next SOM
+      continue;
+    }
+    if (have < length) return false;
+
+    uint8_t n = length - trailer;
+    bool good;
+    if (trailer == 2) {
+      uint16_t crc = OSDP_CRC_INIT;
+      for (uint8_t i=0; i<n; i++) crc = osdpCrcByte(crc, r.at(i));
+      good = crc == (r.at(n) | (r.at(n + 1) << 8));
+    } else {
+      uint8_t sum = 0;
+      for (uint8_t i=0; i<=n; i++) sum += r.at(i);
+      good = sum == 0;
+    }
+    if (!good) {
+      r.consume(1);
+      continue;
+    }
+
+    p.addr = r.at(1);
+    p.seq = ctrl & 3;
+    p.code = r.at(header);
+    p.data = header + 1;
+    p.dataLength = n - p.data;
+    p.length = length;
+    return true;
+  }
+}
+
+// Builds a packet into out, which needs room for 8 + n bytes, and returns its length.
+static inline uint8_t osdpBuildPacket(uint8_t *out, uint8_t addr, uint8_t seq, uint8_t code,
+                                      const uint8_t *data, uint8_t n) {
+  uint8_t length = 8 + n;
+  out[0] = OSDP_SOM;
+  out[1] = addr;
+  out[2] = length;
+  out[3] = 0;
+  out[4] = seq | OSDP_CTRL_CRC;
+  out[5] = code;
+  for (uint8_t i=0; i<n; i++) out[6 + i] = data[i];
+  uint16_t crc = OSDP_CRC_INIT;
+  for (uint8_t i=0; i<length-2; i++) crc = osdpCrcByte(crc, out[i]);
+  out[length - 2] = crc;
+  out[length - 1] = crc >> 8;
+  return length;
+}
+
+
+// The controller.  Readers are polled one at a time, each when it's due: often while
+// it is being used, so the keys of a PIN come through promptly, less often when idle,
+// and seldom while it isn't answering.  Anything waiting to be sent to a reader (an
+// LED or beeper command) goes in place of its next poll.
+#define OSDP_MAX_READERS 4
+#define OSDP_POLL_ACTIVE_MS 20
+#define OSDP_POLL_IDLE_MS 100
+#define OSDP_POLL_OFFLINE_MS 1000
+#define OSDP_ACTIVE_MS 5000        // a reader is active this long after a card or key
+#define OSDP_REPLY_TIMEOUT_MS 200  // the longest the OSDP standard lets a reader take
+#define OSDP_OFFLINE_MISSES 3      // missed replies in a row before a reader is offline
+#define OSDP_MAX_COMMAND 22        // the LED command, the longest we send
+
+// Returned by osdpController::reply() and timeout()
+#define OSDP_EVENT_NONE 0
+#define OSDP_EVENT_CARD 1     // RAW card data: bits long, data bytes from ev.data
+#define OSDP_EVENT_KEYS 2     // keypad: length keys from ev.data
+#define OSDP_EVENT_ONLINE 3
+#define OSDP_EVENT_OFFLINE 4
+
+struct osdpEvent {
+  uint8_t reader;      // index into osdpController::readers
+  uint8_t data;        // offset in the ring
+  uint8_t length;
+  uint16_t bits;
+};
+
+struct osdpReader {
+  uint8_t addr;
+  uint8_t seq;          // 0 until the reader answers, then 1, 2, 3, 1...
+  bool online;
+  uint8_t misses;
+  uint8_t sentCode;     // the command waiting for a reply
+  uint32_t due;         // millis() when it should next be polled
+  uint32_t lastUsed;    // millis() of its last card or key
+  bool used;            // has sent a card or key since it came online
+  uint8_t ledColor;
+  bool ledPending;
+  bool beepPending;
+  uint16_t polls, replies, timeouts, naks;
+};
+
+struct osdpController {
+  osdpReader readers[OSDP_MAX_READERS];
+  uint8_t count = 0;
+  int8_t waiting = -1;  // the reader a command has gone to, -1 while the bus is free
+  uint32_t sentAt = 0;
+  uint8_t next = 0;     // where the search for a due reader starts, for fairness
+
+  void begin(uint8_t n, uint32_t now) {
+    count = n > OSDP_MAX_READERS ? OSDP_MAX_READERS : n;
+    for (uint8_t i=0; i<count; i++) {
+      osdpReader &r = readers[i];
+      r = osdpReader();
+      r.addr = i;
+      r.due = now;
+      r.ledColor = OSDP_GREEN;
+    }
+    waiting = -1;
+  }
+
+  uint32_t interval(const osdpReader &r, uint32_t now) const {
+    if (!r.online) return OSDP_POLL_OFFLINE_MS;
+    if (r.used && now - r.lastUsed < OSDP_ACTIVE_MS) return OSDP_POLL_ACTIVE_MS;
+    return OSDP_POLL_IDLE_MS;
+  }
+
+  // Sets the LED colour on every reader
+  void setLed(uint8_t color) {
+    for (uint8_t i=0; i<count; i++) {
+      readers[i].ledColor = color;
+      readers[i].ledPending = true;
+    }
+  }
+
+  void beep(uint8_t i) {
+    if (i < count) readers[i].beepPending = true;
+  }
+
+  // Builds the next command into out (OSDP_MAX_COMMAND bytes) if the bus is free and
+  // a reader is due.  Returns its length, or 0.
+  uint8_t poll(uint32_t now, uint8_t *out) {
+    if (waiting >= 0) return 0;
+    for (uint8_t k=0; k<count; k++) {
+      uint8_t i = (next + k) % count;
+      osdpReader &r = readers[i];
+      if ((int32_t)(now - r.due) < 0) continue;
+
+      uint8_t data[14];
+      uint8_t n = 0;
+      if (r.ledPending && r.online) {
+        // reader 0, LED 0, no temporary setting, then a permanent steady colour
+        static const uint8_t led[14] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0 };
+        for (n=0; n<14; n++) data[n] = led[n];
+        data[12] = r.ledColor;
+        r.sentCode = OSDP_LED;
+      } else if (r.beepPending && r.online) {
+        // reader 0, default tone, 100ms on, 0 off, once
+        data[0] = 0, data[1] = 2, data[2] = 1, data[3] = 0, data[4] = 1;
+        n = 5;
+        r.sentCode = OSDP_BUZ;
+      } else r.sentCode = OSDP_POLL;
+
+      r.polls++;
+      waiting = i;
+      sentAt = now;
+      next = i + 1;
+      return osdpBuildPacket(out, r.addr, r.seq, r.sentCode, data, n);
+    }
+    return 0;
+  }
+
+  // Handles a packet from the ring.  A card or keys are left in the ring, described by
+  // ev, to be read before the packet is consumed.
+  uint8_t reply(const osdpRing &ring, const osdpPacket &p, uint32_t now, osdpEvent &ev) {
+    if (waiting < 0 || !(p.addr & OSDP_REPLY)) return OSDP_EVENT_NONE;
+    osdpReader &r = readers[waiting];
+    if ((p.addr & ~OSDP_REPLY) != r.addr) return OSDP_EVENT_NONE;
+    ev.reader = waiting;
+    waiting = -1;
+
+    uint8_t rv = OSDP_EVENT_NONE;
+    r.replies++;
+    r.misses = 0;
+    if (!r.online) {
+      r.online = true;
+      r.used = false;
+      r.ledPending = true;
+      rv = OSDP_EVENT_ONLINE;
+    }
+
+    if (p.code == OSDP_NAK) {
+      // Most likely the reader has restarted and wants to begin again at sequence 0
+      r.naks++;
+      r.seq = 0;
+    } else {
+      r.seq = r.seq % 3 + 1;
+      if (r.sentCode == OSDP_LED) r.ledPending = false;
+      if (r.sentCode == OSDP_BUZ) r.beepPending = false;
+
+      if (p.code == OSDP_RAW && p.dataLength >= 4) {
+        // reader number, format, bit count (LSB first), the bits, MSB first
+        ev.bits = ring.at(p.data + 2) | (ring.at(p.data + 3) << 8);
+        ev.data = p.data + 4;
+        ev.length = p.dataLength - 4;
+        if ((ev.bits + 7) / 8 <= ev.length) rv = OSDP_EVENT_CARD;
+      } else if (p.code == OSDP_KEYPAD && p.dataLength >= 2) {
+        // reader number, key count, the keys
+        ev.data = p.data + 2;
+        ev.length = ring.at(p.data + 1);
+        if (ev.length > p.dataLength - 2) ev.length = p.dataLength - 2;
+        rv = OSDP_EVENT_KEYS;
+      }
+      if (rv == OSDP_EVENT_CARD || rv == OSDP_EVENT_KEYS) {
+        r.used = true;
+        r.lastUsed = now;
+      }
+    }
+    r.due = now + interval(r, now);
+    return rv;
+  }
+
+  // Gives up on a reply that hasn't come.  Returns OSDP_EVENT_OFFLINE when a reader
+  // has now missed too many.
+  uint8_t timeout(uint32_t now, osdpEvent &ev) {
+    if (waiting < 0 || now - sentAt < OSDP_REPLY_TIMEOUT_MS) return OSDP_EVENT_NONE;
+    osdpReader &r = readers[waiting];
+    ev.reader = waiting;
+    waiting = -1;
+    r.timeouts++;
+    uint8_t rv = OSDP_EVENT_NONE;
+    if (r.online && ++r.misses >= OSDP_OFFLINE_MISSES) {
+      r.online = false;
+      r.seq = 0;
+      rv = OSDP_EVENT_OFFLINE;
+    }
+    r.due = now + interval(r, now);
+    return rv;
+  }
+};
+
+// An OSDP keypad key as translateWiegand numbers keys: 0-9, 10 for *, 11 for #.
+// Returns 0xFF for anything else.
+static inline uint8_t osdpKey(uint8_t c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c == '*' || c == 0x7F) return 10;
+  if (c == '#' || c == 0x0D) return 11;
+  return 0xFF;
+}
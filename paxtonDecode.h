@@ -0,0 +1,110 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <stdint.h>
+
+// The Paxton reader protocol decoder, separated from the Timer4 capture code in
+// paxtonReceiver.cpp the same way irDecode.h is, so it can also be compiled on a PC.
+//
+// The protocol is the one translateWiegand sends: the reader sets Data, then pulls
+// Clock low, then lets it go high again.  Data low is a 1.  Words are 4 bits, LSB
+// first, each followed by an odd parity bit.  A message starts with word 0x0b after
+// a run of idle (0) clocks, ends with word 0x0f, and is followed by a word that is
+// the xor of all the others.
+//
+// edge() is called on each fall of Clock, with the data bit and the time since the
+// previous fall.  Times are in Timer4 ticks: 16MHz / 8 prescaler = 2MHz.
+
+#define PAXTON_RX_TICKS(us) ((uint16_t)((us) * 2))
+
+// Clock falls closer together than this are noise and are ignored.
+#define PAXTON_RX_MIN_TICKS PAXTON_RX_TICKS(50)
+// A message that stops clocking for this long is abandoned.  The Companion sends a
+// clock every 600us, Paxton readers faster.
+#define PAXTON_RX_GAP_TICKS PAXTON_RX_TICKS(5000)
+
+// The longest message: a card swipe is 0x0b, 8 digits, 0x0f.  (paxtonMessage in
+// RuggedPax.h has room for this many.)
+#define PAXTON_RX_MAX_WORDS 12
+
+// Returned by edge()
+#define PAXTON_RX_NOTHING   0
+#define PAXTON_RX_MESSAGE   1  // a whole message with good parity is in words[]
+#define PAXTON_RX_NOISE     2  // the edge was ignored
+#define PAXTON_RX_BAD_WORD  3  // a word failed its parity bit
+#define PAXTON_RX_BAD_LRC   4  // the message failed its parity word
+#define PAXTON_RX_FRAMING   5  // no start word, too long, or stopped partway
+
+struct paxtonDecoder {
+
+  bool receiving = false;
+  bool gotEnd = false;      // the 0x0f end word is in; the parity word is next
+  uint8_t bitCount = 0;
+  uint8_t word = 0;
+  uint8_t lrc = 0;
+  uint8_t length = 0;
+  uint8_t words[PAXTON_RX_MAX_WORDS];
+
+  // ticks is the time since the previous fall that wasn't noise.  gap is set when that
+  // was too long ago for ticks to be trusted (Timer4 wraps every 32.768ms).
+  inline uint8_t edge(bool bit, uint16_t ticks, bool gap) {
+    if (!gap && ticks < PAXTON_RX_MIN_TICKS) return PAXTON_RX_NOISE;
+
+    uint8_t rv = PAXTON_RX_NOTHING;
+    if (receiving && (gap || ticks > PAXTON_RX_GAP_TICKS)) {
+      receiving = false;
+      rv = PAXTON_RX_FRAMING;
+    }
+
+    if (!receiving) {
+      // Idle clocks carry 0s.  The first 1 is the low bit of the start word.
+      if (!bit) return rv;
+      receiving = true;
+      gotEnd = false;
+      bitCount = word = lrc = length = 0;
+    }
+
+    word |= bit << bitCount;
+    if (++bitCount < 5) return rv;
+
+    uint8_t w = word;
+    bitCount = word = 0;
+    // odd parity over the 4 bits and the parity bit
+    uint8_t p = w ^ (w >> 4);
+    p ^= p >> 2;
+    p ^= p >> 1;
+    if (!(p & 1)) {
+      receiving = false;
+      return PAXTON_RX_BAD_WORD;
+    }
+    w &= 0x0f;
+
+    if (gotEnd) {
+      receiving = false;
+      return w == lrc ? PAXTON_RX_MESSAGE : PAXTON_RX_BAD_LRC;
+    }
+    if ((length == 0 && w != 0x0b) || length == PAXTON_RX_MAX_WORDS) {
+      receiving = false;
+      return PAXTON_RX_FRAMING;
+    }
+    words[length++] = w;
+    lrc ^= w;
+    if (w == 0x0f) gotEnd = true;
+    return rv;
+  }
+};
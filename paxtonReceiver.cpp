@@ -0,0 +1,199 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Arduino.h"
+#include "RuggedPax.h"
+#include "paxtonDecode.h"
+
+
+// Receives the Paxton reader protocol with Timer4's input capture on GPIO49 (ICP4),
+// which catches each fall of Clock, and Data on GPIO42.  Timer4 is the same 2MHz
+// free-running timer translateWiegand times Wiegand pulses with; capturing doesn't
+// disturb it.  Each fall is decoded right in the capture interrupt (paxtonDecode.h),
+// and whole messages are left in a small queue for loop().
+//
+// Wired to a genuine Paxton reader or keypad, its messages can be translated (option
+// 149).  Wired alongside one and its ACU, the bus can be watched (serial command SNIFF).
+
+#define PAXTON_RX_CLOCK_PIN 49
+#define PAXTON_RX_DATA_PIN 42      // PL7
+#define PAXTON_RX_GAP_MS 5
+
+static paxtonDecoder decoder;
+static uint16_t lastFallIcr;
+static unsigned long lastFallMs;
+
+// Received messages, waiting for take()
+#define PAXTON_RX_QUEUE 4
+static paxtonMessage queue[PAXTON_RX_QUEUE];
+static volatile byte queueIn, queueOut;  // wrapping counts
+
+static bool started;
+static bool claimed;  // translateWiegand takes the messages; otherwise loop() drops them
+bool paxtonReceiver::sniffing;
+
+static volatile uint16_t messagesReceived;
+static volatile uint16_t badWords;
+static volatile uint16_t badLrcs;
+static volatile uint16_t framingErrors;
+static volatile uint16_t noiseEdges;
+static volatile uint16_t queueOverruns;
+
+
+ISR(TIMER4_CAPT_vect) {
+  ISR_PROFILE_BEGIN(ISR_SLOT_TIMER4_CAPT);
+  uint16_t icr = ICR4;
+  ISR_PROFILE_LATENCY(ISR_SLOT_TIMER4_CAPT, (uint16_t)(TCNT4 - icr) * 8);
+
+  bool bit = !(PINL & _BV(7));  // Data low is a 1
+  unsigned long ms = millis();
+  bool gap = ms - lastFallMs > PAXTON_RX_GAP_MS;
+
+  switch (decoder.edge(bit, icr - lastFallIcr, gap)) {
+  case PAXTON_RX_NOISE:
+    noiseEdges++;
+    ISR_PROFILE_END(ISR_SLOT_TIMER4_CAPT);
+    return;
+  case PAXTON_RX_MESSAGE:
+    if ((byte)(queueIn - queueOut) < PAXTON_RX_QUEUE) {
+      paxtonMessage &m = queue[queueIn % PAXTON_RX_QUEUE];
+      memcpy(m.words, decoder.words, decoder.length);
+      m.length = decoder.length;
+      m.when = ms;
+      queueIn++;
+      messagesReceived++;
+    } else queueOverruns++;
+    break;
+  case PAXTON_RX_BAD_WORD: badWords++; break;
+  case PAXTON_RX_BAD_LRC: badLrcs++; break;
+  case PAXTON_RX_FRAMING: framingErrors++; break;
+  }
+  lastFallIcr = icr;
+  lastFallMs = ms;
+  ISR_PROFILE_END(ISR_SLOT_TIMER4_CAPT);
+}
+
+
+static void paxtonReceiver::begin(bool claim) {
+  if (claim) claimed = true;
+  if (started) return;
+  started = true;
+
+  pinMode(PAXTON_RX_CLOCK_PIN, INPUT_PULLUP);
+  pinMode(PAXTON_RX_DATA_PIN, INPUT_PULLUP);
+
+  noInterrupts();
+  // Timer4 free running at 2MHz (as translateWiegand sets it), capturing falls of
+  // Clock through the noise canceller.
+  TCCR4A = 0;
+  TCCR4B = _BV(ICNC4) | _BV(CS41);
+  TCCR4C = 0;
+  TIFR4 = _BV(ICF4);
+  TIMSK4 |= _BV(ICIE4);
+  lastFallMs = millis();
+  interrupts();
+}
+
+
+static bool paxtonReceiver::take(paxtonMessage &m) {
+  noInterrupts();
+  if (queueIn == queueOut) {
+    interrupts();
+    return false;
+  }
+  m = queue[queueOut % PAXTON_RX_QUEUE];
+  queueOut++;
+  interrupts();
+
+  if (sniffing) printMessage(m);
+  return true;
+}
+
+
+static void paxtonReceiver::loop() {
+  if (!started || claimed) return;
+  paxtonMessage m;
+  while (take(m));
+}
+
+
+static bool paxtonReceiver::cardNumber(const paxtonMessage &m, uint32_t *card) {
+  if (m.length != 10 || m.words[9] != 0x0f) return false;
+  uint32_t c = 0;
+  for (byte i=1; i<9; i++) {
+    if (m.words[i] > 9) return false;
+    c = c * 10 + m.words[i];
+  }
+  *card = c;
+  return true;
+}
+
+
+// Keys come back as translateWiegand numbers them: 0-9, 10 for *, 11 for #, 12 for bell.
+static bool paxtonReceiver::keypress(const paxtonMessage &m, byte *key) {
+  if (m.length != 6 || m.words[1] != 0x0c || m.words[4] != 0x0e || m.words[5] != 0x0f) return false;
+  byte k = m.words[3];
+  if (m.words[2] == 0 && k <= 9) *key = (k == 9) ? 0 : k + 1;
+  else if (m.words[2] == 1 && k == 0) *key = 10;
+  else if (m.words[2] == 1 && k == 1) *key = 11;
+  else if (m.words[2] == 1 && k == 5) *key = 12;
+  else return false;
+  return true;
+}
+
+
+static void paxtonReceiver::printMessage(const paxtonMessage &m) {
+  Serial.print(F("Paxton in at "));
+  Serial.print(m.when);
+  Serial.print(F("ms:"));
+  for (byte i=0; i<m.length; i++) {
+    Serial.print(' ');
+    Serial.print(m.words[i], HEX);
+  }
+  uint32_t card;
+  byte key;
+  if (cardNumber(m, &card)) {
+    Serial.print(F("  card "));
+    Serial.println(card);
+  } else if (keypress(m, &key)) {
+    Serial.print(F("  key "));
+    Serial.println(key);
+  } else Serial.println();
+}
+
+
+static void paxtonReceiver::printStats() {
+  noInterrupts();
+  uint16_t received = messagesReceived, words = badWords, lrcs = badLrcs;
+  uint16_t framing = framingErrors, noise = noiseEdges, overruns = queueOverruns;
+  interrupts();
+
+  Serial.print(F("Paxton receiver (clock GPIO49, data GPIO42): "));
+  Serial.println(started ? F("running") : F("off"));
+  Serial.print(F("Messages: "));
+  Serial.print(received);
+  Serial.print(F(", bad word parity: "));
+  Serial.print(words);
+  Serial.print(F(", bad message parity: "));
+  Serial.print(lrcs);
+  Serial.print(F(", framing: "));
+  Serial.print(framing);
+  Serial.print(F(", noise: "));
+  Serial.print(noise);
+  Serial.print(F(", lost: "));
+  Serial.println(overruns);
+}
@@ -0,0 +1,164 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Arduino.h"
+#include "RuggedPax.h"
+
+
+// Plays beep/LED patterns on the card reader: the beep line on GPIO11 and the LED
+// line on GPIO12.  Both lines are active low and open-drain as far as the reader is
+// concerned: the beep line is driven low or left floating, the LED line is driven
+// low or left pulled up.
+//
+// Patterns are timed by the Timer0 compare A interrupt, which is only enabled while
+// a pattern is playing.
+
+
+#define READER_BEEP_PIN 11
+#define READER_LED_PIN 12
+
+// Outputs in a step
+#define FB_BEEP 1
+#define FB_LED  2
+
+// Timer0 compare A happens every 1.024ms, so a step's duration is in ~10ms units.
+#define TICKS_PER_UNIT 10
+
+struct feedbackStep {
+  byte outputs;   // FB_BEEP and/or FB_LED
+  byte duration;  // in 10ms units.  0 ends the pattern, after setting its outputs.
+};
+
+// Left open: five 100ms beeps
+static const feedbackStep PROGMEM leftOpenSteps[] = {
+  {FB_BEEP, 10}, {0, 10}, {FB_BEEP, 10}, {0, 10}, {FB_BEEP, 10}, {0, 10},
+  {FB_BEEP, 10}, {0, 10}, {FB_BEEP, 10}, {0, 0}
+};
+// Granted: LED on (green on most readers) for 2 seconds, with a short beep
+static const feedbackStep PROGMEM grantedSteps[] = {
+  {FB_BEEP|FB_LED, 15}, {FB_LED, 185}, {0, 0}
+};
+// Denied: three quick beeps
+static const feedbackStep PROGMEM deniedSteps[] = {
+  {FB_BEEP, 8}, {0, 8}, {FB_BEEP, 8}, {0, 8}, {FB_BEEP, 8}, {0, 0}
+};
+// Jammed lock: three long beeps with the LED flashing
+static const feedbackStep PROGMEM jamSteps[] = {
+  {FB_BEEP|FB_LED, 50}, {0, 30}, {FB_BEEP|FB_LED, 50}, {0, 30}, {FB_BEEP|FB_LED, 50}, {0, 0}
+};
+static const feedbackStep * const patterns[] PROGMEM = { leftOpenSteps, grantedSteps, deniedSteps, jamSteps };
+
+
+// Ports and masks for the two pins, looked up once in setup()
+static volatile uint8_t *beepDdr;
+static uint8_t beepMask;
+static volatile uint8_t *ledDdr;
+static volatile uint8_t *ledPort;
+static uint8_t ledMask;
+
+static const feedbackStep *nextStep;
+static byte ticksLeft;
+static byte unitsLeft;
+static volatile bool ledOwned=false;
+static volatile bool playing=false;
+
+
+static void readerFeedback::setup() {
+  uint8_t port = digitalPinToPort(READER_BEEP_PIN);
+  beepDdr = portModeRegister(port);
+  beepMask = digitalPinToBitMask(READER_BEEP_PIN);
+  port = digitalPinToPort(READER_LED_PIN);
+  ledDdr = portModeRegister(port);
+  ledPort = portOutputRegister(port);
+  ledMask = digitalPinToBitMask(READER_LED_PIN);
+
+  // With PORT low, setting DDR pulls the beep line low, clearing it lets it float.
+  pinMode(READER_BEEP_PIN, INPUT);
+}
+
+
+static void readerFeedback::timer0_compA_isr() {
+  if (--ticksLeft) return;
+  ticksLeft = TICKS_PER_UNIT;
+  if (--unitsLeft) return;
+
+  byte outputs = pgm_read_byte(&nextStep->outputs);
+  byte duration = pgm_read_byte(&nextStep->duration);
+  nextStep++;
+
+  if (outputs & FB_BEEP) *beepDdr |= beepMask;
+  else *beepDdr &= ~beepMask;
+
+  if (ledOwned) {
+    if (outputs & FB_LED) {
+      *ledPort &= ~ledMask;
+      *ledDdr |= ledMask;
+    } else {
+      *ledDdr &= ~ledMask;
+      *ledPort |= ledMask;
+    }
+  }
+
+  if (duration) {
+    unitsLeft = duration;
+    return;
+  }
+
+  // Pattern over: stop the interrupt until the next one.
+  TIMSK0 &= ~_BV(OCIE0A);
+  ledOwned = false;
+  playing = false;
+}
+
+
+static void readerFeedback::play(byte pattern) {
+  if (pattern >= sizeof(patterns) / sizeof(patterns[0])) return;
+  const feedbackStep *steps = (const feedbackStep *)pgm_read_ptr(&patterns[pattern]);
+
+  // Take over the LED only for patterns that use it.
+  bool usesLed = false;
+  for (const feedbackStep *s = steps; ; s++) {
+    if (pgm_read_byte(&s->outputs) & FB_LED) usesLed = true;
+    if (pgm_read_byte(&s->duration) == 0) break;
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  nextStep = steps;
+  ticksLeft = 1;
+  unitsLeft = 1;
+  ledOwned = ledOwned || usesLed;
+  playing = true;
+  TIFR0 = _BV(OCF0A);
+  TIMSK0 |= _BV(OCIE0A);
+  SREG = oldSREG;
+}
+
+
+static bool readerFeedback::ownsLed() {
+  return ledOwned;
+}
+
+static bool readerFeedback::isPlaying() {
+  return playing;
+}
+
+// Plays the jam pattern when the lock is first believed jammed.
+static bool readerFeedback::onEvent(byte event, uint32_t value) {
+  if (event == busJam && value == 1) play(jam);
+  return false;
+}
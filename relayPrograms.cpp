@@ -21,7 +21,88 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
 static byte programSelection[4];
-static displayPage *initialPage=NULL;
+// Which relays setRelay() has turned on, one bit per relay
+static byte relaysOn=0;
+static bool anyDetailPageShown=false;
+
+// Programs 8 and 112 mirror an input onto a relay from interrupts: A12 (PK4) has a
+// pin change interrupt, and shield pin 8 (PH5), which has none, is sampled by the
+// 200us Timer3 tick.  The handlers write the relay port themselves, through masks
+// worked out in setup(); loop() only catches relaysOn up, for busRelay.
+#define MIRROR_A12_BIT 4        // PINK
+#define MIRROR_PIN8_BIT 5       // PINH
+static byte mirrorA12, mirrorPin8;          // relays following each input, one bit each
+static volatile byte mirrorOn;              // mirror relays the handlers have on
+static byte mirrorReported;                 // mirrorOn as loop() last saw it
+static volatile uint8_t *relayPort;         // GPIO31-34 are all on PORTC
+static uint8_t relayBits[4];
+static uint32_t minOnTicks[4];              // minimum on-time, in Timer3 ticks
+static volatile uint32_t stretchTicks[4];   // on-time left to run
+static byte lastPin8;                       // PINH bit 5 at the last tick
+static byte lastA12;                        // PINK bit 4 at the last A12 change
+static void startMirrors();
+static void mirror(byte i, bool grounded);
+
+static const char PROGMEM menuText[] = "Relay program is\nactive.\n\nHold for details";
+static const char PROGMEM program8Text[] = "Relay%d program 8:\n"
+                                           "energized when shield\n"
+                                           " pin 8 to ground or\n"
+                                           " to pin 9";
+static const char PROGMEM program20Text[] = "Relay%d program 20:\n"
+                                            " energized when door\n"
+                                            " believed locked via\n"
+                                            " current sensing";
+// Programs 35, 36 and 37 are implemented in Doorman
+static const char PROGMEM program35Text[] = "Relay%d program 35:\n"
+                                            " energize when door\n"
+                                            " not closed or motion\n"
+                                            " detected";
+static const char PROGMEM program36Text[] = "Relay%d program 36:\n"
+                                            " energize when door\n"
+                                            " detected as closed";
+static const char PROGMEM program37Text[] = "Relay%d program 37:\n"
+                                            " energize when door\n"
+                                            " detected as locked";
+static const char PROGMEM program38Text[] = "Relay%d program 38:\n"
+                                            " energize when motion\n"
+                                            " sensor reports\n"
+                                            " motion";
+static const char PROGMEM program47Text[] = "Relay%d program 47:\n"
+                                            " switched by keypad\n"
+                                            " actions (KEYn= on\n"
+                                            " serial)";
+static const char PROGMEM program48Text[] = "Relay%d program 48:\n"
+                                            " follows its relay\n"
+                                            " rule (RULEn= on\n"
+                                            " serial)";
+static const char PROGMEM program112Text[] = "Relay%d program 112:\n"
+                                             " energized when input\n"
+                                             " A12 is grounded\n";
+
+// One page per relay per program, each shown only when that relay runs that program.
+#define RELAY_DETAIL_PAGES(i) \
+  { program8Text, NULL, NULL, &programSelection[i], 8, i+1 }, \
+  { program20Text, NULL, NULL, &programSelection[i], 20, i+1 }, \
+  { program35Text, NULL, NULL, &programSelection[i], 35, i+1 }, \
+  { program36Text, NULL, NULL, &programSelection[i], 36, i+1 }, \
+  { program37Text, NULL, NULL, &programSelection[i], 37, i+1 }, \
+  { program38Text, NULL, NULL, &programSelection[i], 38, i+1 }, \
+  { program47Text, NULL, NULL, &programSelection[i], 47, i+1 }, \
+  { program48Text, NULL, NULL, &programSelection[i], 48, i+1 }, \
+  { program112Text, NULL, NULL, &programSelection[i], 112, i+1 }
+#define RELAY_DETAIL_LIST(i) \
+  &detailPages[9*i], &detailPages[9*i+1], &detailPages[9*i+2], &detailPages[9*i+3], \
+  &detailPages[9*i+4], &detailPages[9*i+5], &detailPages[9*i+6], &detailPages[9*i+7], \
+  &detailPages[9*i+8]
+
+static const displayPage detailPages[] PROGMEM = {
+  RELAY_DETAIL_PAGES(0), RELAY_DETAIL_PAGES(1), RELAY_DETAIL_PAGES(2), RELAY_DETAIL_PAGES(3)
+};
+static const displayPage * const detailPageList[] PROGMEM = {
+  RELAY_DETAIL_LIST(0), RELAY_DETAIL_LIST(1), RELAY_DETAIL_LIST(2), RELAY_DETAIL_LIST(3), NULL
+};
+
+const displayPage relayPrograms::menuPage PROGMEM = { menuText, NULL, detailPageList, (const byte*)&anyDetailPageShown, true };
 
 
 // Note that the Doorman module also has some of the relay programs in it,
@@ -32,97 +113,165 @@ static void relayPrograms::setup() {
   for (int i=0; i<4; i++) {
     byte p = eepromconfig::get_relayprogram(i+1);
     programSelection[i] = p;
-    char buf[100];
     switch (p) {
     case 8:
-      sprintf_P(buf, PSTR("Relay%d program 8:\n"
-                          "energized when shield\n"
-                          " pin 8 to ground or\n"
-                          " to pin 9"), i+1);
-      addRelayDetailPage(new displayPage(buf));
       pinMode(8, INPUT_PULLUP);
       pinMode(9, OUTPUT);
       digitalWrite(9, LOW);
       pinMode(FIRST_RELAY_GPIO+i, OUTPUT);
+      mirrorPin8 |= 1 << i;
       break;
     case 20:
-      sprintf_P(buf, PSTR("Relay%d program 20:\n"
-                          " energized when door\n"
-                          " believed locked via\n"
-                          " current sensing"), i+1);
-      addRelayDetailPage(new displayPage(buf));
       pinMode(FIRST_RELAY_GPIO+i, OUTPUT);
       break;
-    /*
-      // implemented in Doorman
-        "Relay%d program 35:\n"
-        " energize when door\n"
-        " not closed or motion\n"
-        " detected"), i+1);
-        "Relay%d program 36:\n"
-        " energize when door\n"
-        " detected as closed"), i+1);
-        "Relay%d program 37:\n"
-          " energize when door\n"
-          " detected as locked"), i+1);
-    */
+    /* programs 35,36,37 are implemented in Doorman, which shows their pages */
     case 38:
-      sprintf_P(buf, PSTR("Relay%d program 38:\n"
-                          " energize when motion\n"
-                          " sensor reports\n"
-                          " motion"), i+1);
-      addRelayDetailPage(new displayPage(buf));
       pinMode(FIRST_RELAY_GPIO+i, OUTPUT);
       doorman::activateMotionSensing();
       break;
+    case 47:
+    case 48:
+      pinMode(FIRST_RELAY_GPIO+i, OUTPUT);
+      break;
     case 112:
-      sprintf_P(buf, PSTR("Relay%d program 112:\n"
-                          " energized when input\n"
-                          " A12 is grounded\n"), i+1);      
-      addRelayDetailPage(new displayPage(buf));
       pinMode(A12, INPUT_PULLUP);
       pinMode(FIRST_RELAY_GPIO+i, OUTPUT);
+      mirrorA12 |= 1 << i;
       break;
     default:
       programSelection[i] = 0;
       break;
     }
+    if (programSelection[i]) anyDetailPageShown=true;
   }
+
+  if (mirrorA12 | mirrorPin8) startMirrors();
 }
 
+static void startMirrors() {
+  relayPort = portOutputRegister(digitalPinToPort(FIRST_RELAY_GPIO));
+  for (byte i=0; i<4; i++) {
+    relayBits[i] = digitalPinToBitMask(FIRST_RELAY_GPIO+i);
+    // tenths of a second, at 500 ticks each; 255 is erased EEPROM
+    byte tenths = eepromconfig::get_relay_min_on(i+1);
+    minOnTicks[i] = (tenths == 0xFF) ? 0 : tenths * 500UL;
+  }
+  // Timer3 counts the minimum on-times down, as well as sampling pin 8
+  startTimer3();
 
-static void relayPrograms::addRelayDetailPage(displayPage *dp) {
-  if (initialPage==NULL) {
-    initialPage = addDisplayPage(new displayPage(F("Relay program is\nactive.\n\nHold for details")));
-    initialPage->addLongPressDisplayPage(dp);
+  noInterrupts();
+  lastPin8 = PINH & _BV(MIRROR_PIN8_BIT);
+  lastA12 = PINK & _BV(MIRROR_A12_BIT);
+  for (byte i=0; i<4; i++) {
+    if (mirrorPin8 & (1 << i)) mirror(i, !lastPin8);
+    if (mirrorA12 & (1 << i)) mirror(i, !lastA12);
+  }
+  if (mirrorA12) {
+    PCMSK2 |= _BV(PCINT20);
+    PCIFR = _BV(PCIF2);
+    PCICR |= _BV(PCIE2);
+  }
+  interrupts();
+}
+
+
+// From the handlers, with interrupts off: drives relay i from its input (grounded
+// is on).  A grounded edge restarts the minimum on-time, and the relay stays on
+// until the input is released and the on-time has run out.
+static void mirror(byte i, bool grounded) {
+  byte mask = 1 << i;
+  bool on;
+  if (grounded) {
+    stretchTicks[i] = minOnTicks[i];
+    on = true;
   } else {
-    // add subsequent page to the chain
-    initialPage->onLongPress->addDisplayPage(dp);
+    on = stretchTicks[i] != 0;
   }
+  if (((mirrorOn & mask) != 0) == on) return;
+  mirrorOn ^= mask;
+  if (emergencyRelease::forced & mask) return;
+  if (on) *relayPort |= relayBits[i];
+  else *relayPort &= ~relayBits[i];
 }
 
+// PCINT2 also fires for the emergency release on A11, so only an A12 change counts;
+// otherwise each A11 edge would restart the minimum on-time.
+static void relayPrograms::pcint2_isr() {
+  if (!mirrorA12) return;
+  byte a12 = PINK & _BV(MIRROR_A12_BIT);
+  if (a12 == lastA12) return;
+  lastA12 = a12;
+  for (byte i=0; i<4; i++) {
+    if (mirrorA12 & (1 << i)) mirror(i, !a12);
+  }
+}
 
-static void relayPrograms::loop() {
+static void relayPrograms::timer3_compA_isr() {
+  if (!(mirrorA12 | mirrorPin8)) return;
+  byte pin8 = PINH & _BV(MIRROR_PIN8_BIT);
+  bool pin8Changed = pin8 != lastPin8;
+  lastPin8 = pin8;
   for (byte i=0; i<4; i++) {
-    byte p = programSelection[i];
-    switch (p) {
-    case 8:
-      bool a = digitalRead(8)==LOW;
-      digitalWrite(FIRST_RELAY_GPIO+i, a ? HIGH : LOW);
-      break;
-    case 20:
-      digitalWrite(FIRST_RELAY_GPIO+i, (believedLocked && believedLockedValid) ? HIGH : LOW);    
-      break;
-    
-    /* programs 35,36,37 depend on Doorman and are implemented in Doorman loop */
-    case 38:
-      bool motionDetectorSenseInputActive = digitalRead(MOTION_DETECTOR_SENSE_INPUT)==LOW;
-      digitalWrite(FIRST_RELAY_GPIO+i, motionDetectorSenseInputActive ? HIGH : LOW);
-      break;
-    case 112:
-      a = digitalRead(A12)==LOW;
-      digitalWrite(FIRST_RELAY_GPIO+i, a ? HIGH : LOW);
-      break;
+    byte mask = 1 << i;
+    if (pin8Changed && (mirrorPin8 & mask)) mirror(i, !pin8);
+    if (stretchTicks[i] && !--stretchTicks[i]) {
+      // on-time over: off, unless the input is still grounded
+      if (mirrorPin8 & mask) mirror(i, !pin8);
+      else if (mirrorA12 & mask) mirror(i, !(PINK & _BV(MIRROR_A12_BIT)));
     }
   }
+}
+
+
+static void relayPrograms::showRelayDetailPage(byte i, byte p) {
+  programSelection[i] = p;
+  anyDetailPageShown=true;
+}
+
+
+static void relayPrograms::setRelay(byte i, bool on) {
+  byte mask = 1 << i;
+  if (((relaysOn & mask) != 0) == on) return;
+  relaysOn ^= mask;
+  // An emergency release holds its relays; they're put back as relaysOn has them
+  // when it's cleared.  Interrupts stay off so a release can't land in between.
+  uint8_t oldSREG = SREG;
+  cli();
+  if (!(emergencyRelease::forced & mask)) digitalWrite(FIRST_RELAY_GPIO+i, on ? HIGH : LOW);
+  SREG = oldSREG;
+  eventBus::publish(busRelay, i | (on ? 0x100 : 0));
+}
+
+
+static bool relayPrograms::relayOn(byte i) {
+  byte mask = 1 << i;
+  if ((mirrorA12 | mirrorPin8) & mask) return mirrorOn & mask;
+  return relaysOn & mask;
+}
+
+
+// Programs 20 and 38 follow the lock and motion states.
+static bool relayPrograms::onEvent(byte event, uint32_t value) {
+  byte p = (event == busLock) ? 20 : 38;
+  for (byte i=0; i<4; i++) {
+    if (programSelection[i] == p) setRelay(i, value == 1);
+  }
+  return false;
+}
+
+
+// Programs 8 and 112 are driven from the interrupt handlers above; this only
+// publishes what they've done.  Programs 20 and 38 are set by onEvent, 47 by
+// keypadActions, 48 by relayRules, and 35,36,37 are implemented in Doorman.
+static void relayPrograms::loop() {
+  byte on = mirrorOn;
+  byte changed = on ^ mirrorReported;
+  if (!changed) return;
+  mirrorReported = on;
+  for (byte i=0; i<4; i++) {
+    byte mask = 1 << i;
+    if (!(changed & mask)) continue;
+    relaysOn ^= mask;
+    eventBus::publish(busRelay, i | ((on & mask) ? 0x100 : 0));
+  }
 }
\ No newline at end of file
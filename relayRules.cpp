@@ -0,0 +1,303 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Arduino.h"
+#include "RuggedPax.h"
+
+
+// Relay rules: each relay set to relay program 48 follows a logic expression over the
+// board's inputs, such as "door closed and locked and not jammed".  A rule is a short
+// program in postfix (RPN) bytecode, kept in EEPROM: signals push their state, and the
+// operators combine the values on top of the stack.
+//
+// Rules aren't evaluated on every loop.  The door, lock, jam and motion signals come
+// from the event bus, and the input pins are sampled every 10ms, so a rule runs again
+// only when one of the signals it uses has changed (or when its timer runs out).
+
+#define RULE_BYTES 16
+#define RULE_STACK 8
+
+enum {
+  opEnd = 0,
+  opA12 = 1, opA13, opA14, opA15, opPin8, opMotion, opDoor, opLocked, opJammed,
+  opSignals,
+  opAnd = 20, opOr, opXor, opNot,
+  opFor = 30,   // followed by seconds: true once its operand has been true that long
+};
+
+static const char PROGMEM signalNames[] = "A12\0A13\0A14\0A15\0P8\0MOTION\0DOOR\0LOCKED\0JAMMED\0";
+static const char PROGMEM operatorNames[] = "AND\0OR\0XOR\0NOT\0";
+
+// Bits in a rule's signal mask
+#define PIN_SIGNALS ((1 << opA12) | (1 << opA13) | (1 << opA14) | (1 << opA15) | (1 << opPin8))
+
+static byte rules[4][RULE_BYTES];
+static uint16_t ruleSignals[4];    // the signals each rule uses, 0 if it isn't valid
+static byte ruleRelays;            // relays set to program 48, one bit each
+static uint16_t inputs;            // pin signals grounded, by signal bit
+static bool forDone[4];            // a rule's @ operand has been true long enough
+
+static softTimer inputTimer;
+static softTimer forTimers[4];
+
+
+// Checks a rule, returning the signals it uses, or 0 if it isn't a valid rule.
+// A valid rule leaves one value on the stack, never needs more than RULE_STACK,
+// and uses @ at most once.
+static uint16_t check(const byte *code) {
+  uint16_t signals = 0;
+  byte depth = 0;
+  bool timed = false;
+  for (byte i=0; i<RULE_BYTES; i++) {
+    byte op = code[i];
+    if (op == opEnd || op == 0xFF) return depth == 1 ? signals : 0;
+    if (op > opEnd && op < opSignals) {
+      if (++depth > RULE_STACK) return 0;
+      signals |= 1 << op;
+    } else if (op >= opAnd && op <= opXor) {
+      if (depth-- < 2) return 0;
+    } else if (op == opNot) {
+      if (depth < 1) return 0;
+    } else if (op == opFor) {
+      if (depth < 1 || timed || ++i == RULE_BYTES || code[i] == 0) return 0;
+      timed = true;
+    } else {
+      return 0;
+    }
+  }
+  return depth == 1 ? signals : 0;  // a rule filling all RULE_BYTES has no opEnd
+}
+
+static bool readSignal(byte op) {
+  switch (op) {
+  case opMotion: return eventBus::state(busMotion) == 1;
+  case opDoor: return eventBus::state(busDoor) == 1;
+  case opLocked: return eventBus::state(busLock) == 1;
+  case opJammed: return eventBus::state(busJam) == 1;
+  }
+  return inputs & (1 << op);
+}
+
+template <byte R> static void forExpired();
+static void (* const forExpiredFns[4])(void) = { forExpired<0>, forExpired<1>, forExpired<2>, forExpired<3> };
+
+static bool evaluate(byte r) {
+  const byte *code = rules[r];
+  bool stack[RULE_STACK];
+  byte depth = 0;
+  for (byte i=0; i<RULE_BYTES; i++) {
+    byte op = code[i];
+    if (op == opEnd || op == 0xFF) break;
+    if (op < opSignals) {
+      stack[depth++] = readSignal(op);
+      continue;
+    }
+    bool b = stack[--depth];
+    switch (op) {
+    case opAnd: stack[depth-1] = stack[depth-1] && b; break;
+    case opOr: stack[depth-1] = stack[depth-1] || b; break;
+    case opXor: stack[depth-1] = stack[depth-1] != b; break;
+    case opNot: stack[depth++] = !b; break;
+    case opFor:
+      // Starts timing when the operand becomes true; the rule runs again when it's up.
+      if (!b) forTimers[r].stop(), forDone[r] = false;
+      else if (!forDone[r] && !forTimers[r].running()) forTimers[r].start(1000UL * code[i+1], forExpiredFns[r]);
+      stack[depth++] = b && forDone[r];
+      i++;
+      break;
+    }
+  }
+  return stack[0];
+}
+
+static void update(byte r) {
+  if (!(ruleRelays & (1 << r)) || !ruleSignals[r]) return;
+  relayPrograms::setRelay(r, evaluate(r));
+}
+
+template <byte R> static void forExpired() {
+  forDone[R] = true;
+  update(R);
+}
+
+// Runs the rules that use any of the signals that changed
+static void signalsChanged(uint16_t changed) {
+  for (byte r=0; r<4; r++) {
+    if (ruleSignals[r] & changed) update(r);
+  }
+}
+
+static uint16_t readInputs() {
+  uint16_t v = 0;
+  if (digitalRead(A12)==LOW) v |= 1 << opA12;
+  if (digitalRead(A13)==LOW) v |= 1 << opA13;
+  if (digitalRead(A14)==LOW) v |= 1 << opA14;
+  if (digitalRead(A15)==LOW) v |= 1 << opA15;
+  if (digitalRead(8)==LOW) v |= 1 << opPin8;
+  return v;
+}
+
+static void sampleInputs() {
+  uint16_t v = readInputs();
+  uint16_t changed = v ^ inputs;
+  inputs = v;
+  if (changed) signalsChanged(changed);
+}
+
+static void load(byte r) {
+  eepromconfig::get_relay_rule(r, rules[r]);
+  ruleSignals[r] = check(rules[r]);
+  forTimers[r].stop();
+  forDone[r] = false;
+}
+
+// Starts whatever the rules need: the input sampling, the motion detector
+static void start() {
+  uint16_t used = 0;
+  for (byte r=0; r<4; r++) {
+    if (ruleRelays & (1 << r)) used |= ruleSignals[r];
+  }
+  if (used & (1 << opPin8)) pinMode(8, INPUT_PULLUP);
+  if (used & (1 << opMotion)) doorman::activateMotionSensing();
+  if ((used & PIN_SIGNALS) && !inputTimer.running()) inputTimer.every(10, sampleInputs);
+  inputs = readInputs();
+  for (byte r=0; r<4; r++) update(r);
+}
+
+
+static void relayRules::setup() {
+  for (byte r=0; r<4; r++) {
+    load(r);
+    if (eepromconfig::get_relayprogram(r+1) == 48) ruleRelays |= 1 << r;
+  }
+  if (ruleRelays) start();
+}
+
+static bool relayRules::onEvent(byte event, uint32_t value) {
+  switch (event) {
+  case busDoor: signalsChanged(1 << opDoor); break;
+  case busLock: signalsChanged(1 << opLocked); break;
+  case busJam: signalsChanged(1 << opJammed); break;
+  case busMotion: signalsChanged(1 << opMotion); break;
+  }
+  return false;
+}
+
+
+// Finds word (ending at a space or the end) in a PROGMEM list of names, returning
+// its position in the list, or 0xFF.
+static byte lookup(const char *word, byte len, const char *names) {
+  for (byte n=0; pgm_read_byte(names); n++) {
+    byte nl = strlen_P(names);
+    if (nl == len && !strncmp_P(word, names, len)) return n;
+    names += nl + 1;
+  }
+  return 0xFF;
+}
+
+static void printName(const char *names, byte n) {
+  while (n--) names += strlen_P(names) + 1;
+  Serial.print((const __FlashStringHelper *)names);
+}
+
+static void printRule(byte r) {
+  const byte *code = rules[r];
+  Serial.print(F("RULE"));
+  Serial.print(r+1);
+  Serial.print('=');
+  for (byte i=0; i<RULE_BYTES; i++) {
+    byte op = code[i];
+    if (op == opEnd || op == 0xFF) break;
+    if (i) Serial.print(' ');
+    if (op < opSignals) printName(signalNames, op - opA12);
+    else if (op >= opAnd && op <= opNot) printName(operatorNames, op - opAnd);
+    else if (op == opFor && i+1 < RULE_BYTES) {
+      Serial.print('@');
+      Serial.print(code[++i]);
+    } else Serial.print(op);
+  }
+  if (code[0] != opEnd && code[0] != 0xFF && !ruleSignals[r]) Serial.print(F("  (not a valid rule)"));
+  else if (code[0] != opEnd && code[0] != 0xFF && !(ruleRelays & (1 << r))) Serial.print(F("  (relay isn't program 48)"));
+  Serial.println();
+}
+
+static void relayRules::printRules() {
+  for (byte r=0; r<4; r++) printRule(r);
+}
+
+static void store(byte r, const byte *code) {
+  eepromconfig::set_relay_rule(r, code);
+  load(r);
+  if (ruleRelays & (1 << r)) start();
+}
+
+// RULEn=words, in postfix: signals A12 A13 A14 A15 P8 MOTION DOOR LOCKED JAMMED,
+// operators AND OR XOR NOT, and @n for "true for n seconds".  RULEn= removes the rule.
+static bool relayRules::configure(const char *cmd) {
+  if (cmd[0] < '1' || cmd[0] > '4' || cmd[1] != '=') return false;
+  byte r = cmd[0] - '1';
+  byte code[RULE_BYTES];
+  memset(code, opEnd, sizeof(code));
+  byte n = 0;
+  const char *p = cmd + 2;
+  while (*p) {
+    if (*p == ' ') {
+      p++;
+      continue;
+    }
+    byte len = 0;
+    while (p[len] && p[len] != ' ') len++;
+    byte op;
+    if (*p == '@') {
+      int seconds = atoi(p+1);
+      if (seconds < 1 || seconds > 255 || n + 2 > RULE_BYTES) return false;
+      code[n++] = opFor;
+      op = seconds;
+    } else if ((op = lookup(p, len, signalNames)) != 0xFF) {
+      op += opA12;
+    } else if ((op = lookup(p, len, operatorNames)) != 0xFF) {
+      op += opAnd;
+    } else {
+      return false;
+    }
+    if (n == RULE_BYTES) return false;
+    code[n++] = op;
+    p += len;
+  }
+  if (n && !check(code)) return false;
+  store(r, code);
+  printRule(r);
+  return true;
+}
+
+// The IR remote enters a rule a byte at a time (7853xbbb); 0 starts it over.
+static void relayRules::append(byte r, byte op) {
+  byte code[RULE_BYTES];
+  eepromconfig::get_relay_rule(r, code);
+  byte n = 0;
+  while (n < RULE_BYTES && code[n] != opEnd && code[n] != 0xFF) {
+    if (code[n] == opFor) {
+      // Its seconds byte may be 255, and isn't there yet if opEnd follows.
+      if (++n < RULE_BYTES && code[n] == opEnd) break;
+    }
+    n++;
+  }
+  if (op == opEnd) n = 0;
+  else if (n < RULE_BYTES) code[n++] = op;
+  if (n < RULE_BYTES) code[n] = opEnd;
+  store(r, code);
+}
@@ -28,7 +28,9 @@ static serialconfig::setup() {
 }
 
 
-char cmdbuffer[32];
+// Long enough for a relay rule
+#define CMDBUFFER_SIZE 64
+char cmdbuffer[CMDBUFFER_SIZE];
 byte cmdbufferlength=0;
 
 
@@ -40,7 +42,7 @@ static serialconfig::loop() {
   if (c != 13 && c != 10) {
     if (c >= 'a' && c <= 'z') c-=0x20;
     cmdbuffer[cmdbufferlength++] = c;
-    if (cmdbufferlength >= 32) cmdbufferlength = 31;
+    if (cmdbufferlength >= CMDBUFFER_SIZE) cmdbufferlength = CMDBUFFER_SIZE-1;
     cmdbuffer[cmdbufferlength] = 0;
     return;
   }
@@ -52,6 +54,24 @@ static serialconfig::loop() {
     Serial.println(F("Command Help:"));
     Serial.println(F("ERASE = Erase all EEPROM"));
     Serial.println(F("SHOW = Show config"));
+    Serial.println(F("ISR = Show interrupt handler timing (if compiled in)"));
+    Serial.println(F("FB0..FB3 = Play reader pattern: left open, granted, denied, jam"));
+    Serial.println(F("LED = Show recent Paxton LED edges"));
+    Serial.println(F("ACU = Show access verdicts and latency"));
+    Serial.println(F("TRACE = Show card/key timing through each stage"));
+    Serial.println(F("NOISE = Show Wiegand pulses rejected as noise"));
+    Serial.println(F("DUP = Show cards dropped as repeats"));
+    Serial.println(F("READERS = Show each Wiegand reader's message counts"));
+    Serial.println(F("SNIFF = Print Paxton messages on GPIO49/42 (again to stop)"));
+    Serial.println(F("OSDP = Show OSDP readers and their poll counts"));
+    Serial.println(F("KEYS = Show keypad actions"));
+    Serial.println(F("KEYn=keys,relay,action = Set keypad action n (1-8), e.g. KEY1=*,2,P10"));
+    Serial.println(F("  keys: 0-9 * # B(ell); action: Pn pulse n sec, T toggle, L latch; KEYn= removes"));
+    Serial.println(F("ER = Show emergency release status and timing"));
+    Serial.println(F("ERCLEAR = End an emergency release (once A11 is out of alarm)"));
+    Serial.println(F("RULES = Show relay rules"));
+    Serial.println(F("RULEn=words = Set the rule for relay n (1-4), e.g. RULE1=DOOR LOCKED AND"));
+    Serial.println(F("  postfix: A12-A15 P8 MOTION DOOR LOCKED JAMMED, AND OR XOR NOT, @n (true n sec)"));
     Serial.println(F("D0 = Door Option = Single Door, Closed Contacts Closed Door"));
     Serial.println(F("D1 = Door Option = Single Door, Open Contacts Closed Door"));
     Serial.println(F("D2 = Door Option = Double Door, Closed Contacts Closed Door"));
@@ -80,6 +100,90 @@ static serialconfig::loop() {
     return;
   }
 
+  if (!strcmp_P(cmdbuffer,PSTR("ISR"))) {
+    isrProfile::dump();
+    return;
+  }
+
+  if (!strcmp_P(cmdbuffer,PSTR("TRACE"))) {
+    translateWiegand::printTrace();
+    return;
+  }
+
+  if (!strcmp_P(cmdbuffer,PSTR("NOISE"))) {
+    translateWiegand::printNoise();
+    return;
+  }
+
+  if (!strcmp_P(cmdbuffer,PSTR("READERS"))) {
+    translateWiegand::printReaders();
+    return;
+  }
+
+  if (!strcmp_P(cmdbuffer,PSTR("OSDP"))) {
+    osdp::printStatus();
+    return;
+  }
+
+  if (!strcmp_P(cmdbuffer,PSTR("KEYS"))) {
+    keypadActions::printActions();
+    return;
+  }
+
+  if (!strcmp_P(cmdbuffer,PSTR("ER"))) {
+    emergencyRelease::printStatus();
+    return;
+  }
+
+  if (!strcmp_P(cmdbuffer,PSTR("ERCLEAR"))) {
+    if (!emergencyRelease::clear()) Serial.println(F("A11 is still in alarm."));
+    emergencyRelease::printStatus();
+    return;
+  }
+
+  if (!strcmp_P(cmdbuffer,PSTR("RULES"))) {
+    relayRules::printRules();
+    return;
+  }
+
+  if (!strncmp_P(cmdbuffer,PSTR("RULE"),4)) {
+    if (!relayRules::configure(cmdbuffer+4)) Serial.println(F("Not a valid relay rule."));
+    return;
+  }
+
+  if (!strncmp_P(cmdbuffer,PSTR("KEY"),3)) {
+    if (!keypadActions::configure(cmdbuffer+3)) Serial.println(F("Not a valid keypad action."));
+    return;
+  }
+
+  if (!strcmp_P(cmdbuffer,PSTR("SNIFF"))) {
+    paxtonReceiver::sniffing = !paxtonReceiver::sniffing;
+    if (paxtonReceiver::sniffing) paxtonReceiver::begin(false);
+    paxtonReceiver::printStats();
+    Serial.println(paxtonReceiver::sniffing ? F("Sniffing on") : F("Sniffing off"));
+    return;
+  }
+
+  if (!strcmp_P(cmdbuffer,PSTR("DUP"))) {
+    translateWiegand::printDuplicates();
+    return;
+  }
+
+  if (!strcmp_P(cmdbuffer,PSTR("ACU"))) {
+    accessVerdict::printStats();
+    return;
+  }
+
+  if (!strcmp_P(cmdbuffer,PSTR("LED"))) {
+    translateWiegand::printLedEdges();
+    return;
+  }
+
+  if (strlen(cmdbuffer)==3 && cmdbuffer[0]=='F' && cmdbuffer[1]=='B') {
+    readerFeedback::play(cmdbuffer[2]-'0');
+    return;
+  }
+
   if (strlen(cmdbuffer)==2 && cmdbuffer[0]=='D') {
     if (cmdbuffer[1] >= '0' && cmdbuffer[1] <= '7') {
       eepromconfig::set_dooroption(cmdbuffer[1]-'0');
@@ -0,0 +1,132 @@
+/*
+RuggedPaxCompanion Copyright 2024 Michael Caldwell-Waller (@chipguyhere), License: GPLv3
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Arduino.h"
+#include "RuggedPax.h"
+
+
+// A hierarchical timing wheel, ticking once a millisecond.  Level 0 has a slot for
+// each of the next 32ms, level 1 a slot for each of the next 32 blocks of 32ms, and
+// so on up to level 3, whose slots are 32.8 seconds wide and reach 17.5 minutes
+// ahead.  A timer goes into the slot for its expiry time on the lowest level that
+// reaches that far.  When the wheel gets to the start of a higher level's slot, the
+// timers in it are moved down to the levels below, so every timer reaches level 0
+// by the millisecond it's due, and runs then.  A timer further away than level 3
+// reaches goes in the last slot level 3 gets to before wrapping, and is put back
+// where it belongs when that slot comes up.
+//
+// Expiry times are compared as signed differences from the wheel's position, so
+// it goes right on turning when millis() wraps.
+
+#define WHEEL_BITS 5
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+
+static softTimer *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static uint32_t wheelNow;   // the next millisecond to be run
+static softTimer *moving;   // timers taken out of a slot, being cascaded or run
+
+
+static void link(softTimer **head, softTimer *t) {
+  t->next = *head;
+  if (t->next) t->next->pprev = &t->next;
+  *head = t;
+  t->pprev = head;
+}
+
+static void unlink(softTimer *t) {
+  *t->pprev = t->next;
+  if (t->next) t->next->pprev = t->pprev;
+  t->pprev = NULL;
+}
+
+static void insert(softTimer *t) {
+  int32_t delta = t->expires - wheelNow;
+  if (delta < 0) {
+    // Already due: run it on the next tick
+    link(&wheel[0][wheelNow & WHEEL_MASK], t);
+    return;
+  }
+  byte level = 0;
+  while (level < WHEEL_LEVELS-1 && (uint32_t)delta >= (1UL << (WHEEL_BITS * (level+1)))) level++;
+  uint32_t slotTime = t->expires;
+  if ((uint32_t)delta >= (1UL << (WHEEL_BITS * WHEEL_LEVELS))) {
+    slotTime = wheelNow + ((uint32_t)WHEEL_MASK << (WHEEL_BITS * level));
+  }
+  link(&wheel[level][(slotTime >> (WHEEL_BITS * level)) & WHEEL_MASK], t);
+}
+
+// Takes every timer out of a slot, to be put back by the caller
+static void takeSlot(softTimer **slot) {
+  moving = *slot;
+  *slot = NULL;
+  if (moving) moving->pprev = &moving;
+}
+
+static void runTick() {
+  byte index = wheelNow & WHEEL_MASK;
+  for (byte level=1; index == 0 && level < WHEEL_LEVELS; level++) {
+    index = (wheelNow >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    takeSlot(&wheel[level][index]);
+    while (moving) {
+      softTimer *t = moving;
+      unlink(t);
+      insert(t);
+    }
+  }
+
+  takeSlot(&wheel[0][wheelNow & WHEEL_MASK]);
+  wheelNow++;
+  // Callbacks can start and stop timers, including ones still waiting in moving.
+  while (moving) {
+    softTimer *t = moving;
+    unlink(t);
+    if (t->period) {
+      // Periodic timers keep their cadence, unless loop() has fallen a whole period
+      // behind; then they skip ahead, rather than running several times to catch up.
+      t->expires += t->period;
+      if ((int32_t)(t->expires - millis()) <= 0) t->expires = millis() + t->period;
+      insert(t);
+    }
+    (*t->callback)();
+  }
+}
+
+
+void softTimer::start(uint32_t ms, void (*cb)(void)) {
+  if (pprev) unlink(this);
+  callback = cb;
+  period = 0;
+  expires = millis() + ms;
+  insert(this);
+}
+
+void softTimer::every(uint32_t ms, void (*cb)(void)) {
+  start(ms, cb);
+  period = ms;
+}
+
+void softTimer::stop() {
+  if (pprev) unlink(this);
+}
+
+
+static void timerWheel::loop() {
+  uint32_t m = millis();
+  while ((int32_t)(m - wheelNow) >= 0) runTick();
+}
@@ -18,6 +18,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "Arduino.h"
 #include "RuggedPax.h"
+#include "fastPin.h"
 
 
 
@@ -29,99 +30,939 @@ static byte Wiegand1OutputPin = 15;
 #define PaxtonClockOutputPin Wiegand1OutputPin
 static int LEDInputPin = 50;
 static int LEDOutputPin = -1;
-static volatile bool bitArray[70]; // Array to store incoming Wiegand bits
-static volatile int bitIndex = 0; // Index to keep track of the number of received bits
-static unsigned long lastPulseTime = 0; // Time of the last pulse
-static const long WiegandTimeout = 20; // 0.02 seconds timeout
+
+// End of frame: a message is over once the line has been quiet for a few times the
+// longest gap between bits its reader has been seen to leave, within these bounds.
+// Until a message has been seen, the upper bound is used.
+static const long WiegandTimeout = 20; // 0.02 seconds timeout, the upper bound
+static const long WiegandMinTimeoutMicros = 3000;
+static const byte WiegandGapMultiple = 3;
 
 static byte translationOption=0;
 static bool usingPaxtonReaderProtocol=false;
+static bool usingPaxtonReaderInput=false;
+static bool feature_enabled=false;
 
-static displayPage* wiegandDiagnosticsPage;
+static const char PROGMEM menuText[] = "Card Reader / Keypad\ntranslation active.\n\nHold for details";
+static const char PROGMEM detailText[] = "Converts Wiegand RFID\ninto Paxton Reader\nformat (card/keypad).\nMore info tap button.";
+static const char PROGMEM program14Text[] = "Wiegand program 14:\n to Wiegand32,\ninputs GPIO 18,19\noutputs GPIO 14,15";
+static const char PROGMEM programFormatText[] = "Wiegand program %d:\n to that many bits,\n with parity, out\n GPIO 14,15";
+static const char PROGMEM program114Text1[] = "Wiegand program 114:\n Wiegand card reader:\nConnect D0/D1/LED\n to GPIO 18/19/12";
+static const char PROGMEM program114Text2[] = "Wiegand program 114:\n to Paxton protocol:\n Net2 Data/Clk/RedLED\n connects to 14/15/50";
+static const char PROGMEM program160Text1[] = "Wiegand program 160:\n Wiegand card reader:\nConnect D0/D1/LED\n to GPIO 18/19/12";
+static const char PROGMEM program160Text2[] = "Wiegand program 160\n to Paxton Reader:\n Net2 Data/Clk/RedLED\n connects to A0/A1/A2";
+static const char PROGMEM program149Text[] = "Wiegand program 149:\nPaxton reader/keypad\n Data/Clk to 42/49,\n to Wiegand32 14/15";
+static const char PROGMEM program214Text1[] = "Wiegand program 214:\n Net2 Reader 1 port:\n Data/Clk/RedLED\n connects to 14/15/50";
+static const char PROGMEM program214Text2[] = "Wiegand program 214:\n Net2 Reader 2 port:\n Data/Clk\n connects to A0/A1";
+static const char PROGMEM diagnosticsText[] = "Card Reader Test\n\n";
 
-static void paxtonReaderOut(byte pindata, byte pinclock, uint32_t cardnumber);
-static void paxtonKeypressOut(byte pindata, byte pinclock, char key);
+static const displayPage detailPage PROGMEM = { detailText };
+static const displayPage program14Page PROGMEM = { program14Text, NULL, NULL, &translationOption, 14 };
+static const displayPage program26Page PROGMEM = { programFormatText, NULL, NULL, &translationOption, 26, 26 };
+static const displayPage program34Page PROGMEM = { programFormatText, NULL, NULL, &translationOption, 34, 34 };
+static const displayPage program37Page PROGMEM = { programFormatText, NULL, NULL, &translationOption, 37, 37 };
+static const displayPage program114Page1 PROGMEM = { program114Text1, NULL, NULL, &translationOption, 114 };
+static const displayPage program114Page2 PROGMEM = { program114Text2, NULL, NULL, &translationOption, 114 };
+static const displayPage program160Page1 PROGMEM = { program160Text1, NULL, NULL, &translationOption, 160 };
+static const displayPage program160Page2 PROGMEM = { program160Text2, NULL, NULL, &translationOption, 160 };
+static const displayPage program149Page PROGMEM = { program149Text, NULL, NULL, &translationOption, 149 };
+static const displayPage program214Page1 PROGMEM = { program214Text1, NULL, NULL, &translationOption, 214 };
+static const displayPage program214Page2 PROGMEM = { program214Text2, NULL, NULL, &translationOption, 214 };
+static const displayPage * const detailPages[] PROGMEM = {
+  &detailPage, &program14Page, &program26Page, &program34Page, &program37Page, &program114Page1,
+  &program114Page2, &program149Page, &program160Page1, &program160Page2, &program214Page1, &program214Page2, NULL
+};
 
-// Allows other module (like leftOpenBeep) to appropriate the * or escape keypress
-// for another purpose.  Returning true means the keypress was handled and can be discarded
-bool (*star_key_handler)(void) = NULL;
+const displayPage translateWiegand::menuPage PROGMEM = { menuText, NULL, detailPages, (const byte*)&feature_enabled, true };
+const displayPage translateWiegand::diagnosticsPage PROGMEM = {
+  diagnosticsText, pageArena.wiegandDiagnostics, NULL, (const byte*)&feature_enabled, true
+};
 
-// Interrupt handler for receiving a pulse on the zero line.
-// Simply store the zero ("false") and increase the counter of bits received (bitIndex)
-static void zeroPulse() {
-  if (bitIndex < 70) {
-    bitArray[bitIndex++] = false;
-    lastPulseTime = millis();
+static void paxtonReaderOut(byte channel, uint32_t cardnumber);
+static void paxtonKeypressOut(byte channel, char key);
+static void paxtonKeypressesOut(byte channel, const char *keys, byte count);
+static bool paxtonKeypressFrame(char key, byte *message);
+
+// Wiegand pulses are 20-100us long and 0.2-20ms apart.  Both edges of each pulse are
+// timed with Timer4, free running at 2MHz, and pulses that don't fit (with some margin
+// for slightly-off readers) are thrown away as noise and counted, per line.
+#define PULSE_MIN_TICKS 20      // 10us
+#define PULSE_MAX_TICKS 400     // 200us
+#define PULSE_SPACING_MIN_US 150
+
+struct wiegandLine {
+  uint16_t fallTicks;     // TCNT4 at the start of the pulse in progress
+  bool low;               // a pulse is in progress
+  uint16_t tooShort;
+  uint16_t tooLong;
+  uint16_t tooClose;      // started too soon after the previous bit
+  uint16_t unmeasured;    // both edges had passed before the handler ran; kept as a bit
+};
+
+// PIN entry: with a maximum PIN length set, keypresses are collected and sent to the
+// Paxton in one burst once # is pressed, the PIN reaches its maximum length, or no
+// key has been pressed for a while.  # is sent at the end of the burst in every case.
+#define PIN_MAX_LENGTH 16
+#define PIN_ENTRY_TIMEOUT_MS 5000
+static byte pinMaxLength;  // 0 = send each keypress as it comes
+
+// Up to four Wiegand readers, each with its own receive buffer, end of frame learning
+// and PIN entry, so messages arriving together on different readers don't get in each
+// other's way.  Reader 0 is on GPIO18/19 (INT3/INT2), reader 1 on GPIO2/3 (INT4/INT5),
+// readers 2 and 3 on GPIO53/52 and GPIO51/10 (pin change interrupts, with the LED mirror).
+#define WIEGAND_READERS 4
+#define WIEGAND_BYTES ((WIEGAND_MAX_BITS + 7) / 8)
+
+struct wiegandReader {
+  // Filled in by the interrupt handlers
+  volatile byte bits[WIEGAND_BYTES];  // packed, first bit in the top of bits[0]
+  volatile byte bitCount;
+  volatile bool overrun;              // more than WIEGAND_MAX_BITS came in
+  volatile unsigned long firstPulseMicros;
+  volatile unsigned long lastPulseMicros;
+  volatile uint16_t frameMaxGap;      // longest time between pulses in this message, us
+  volatile wiegandLine lines[2];
+
+  uint16_t learnedGap;                // us
+  byte learnedMaxBits;                // longest message that passed its parity check
+
+  char pinEntry[PIN_MAX_LENGTH + 1];  // digits 0-9, room for the #
+  byte pinLength;
+  unsigned long pinLastKeyWhen;       // millis()
+
+  uint16_t frames;
+  uint32_t bitsReceived;
+  uint16_t overruns;
+  uint16_t rejected;                  // too short, or of no length we know
+};
+static wiegandReader readers[WIEGAND_READERS];
+static byte readerCount = 1;
+
+// A message taken from a reader, to be decoded while the reader receives the next one
+struct wiegandFrame {
+  byte bits[WIEGAND_BYTES];
+  byte count;
+  unsigned long firstPulse;
+  unsigned long lastPulse;
+  bool bit(byte i) const { return bits[i >> 3] & (0x80 >> (i & 7)); }
+};
+
+// Stores a received bit, with its timing.  Called from the interrupt handlers.
+// m is micros() at the start of the pulse.
+static inline void receiveBit(wiegandReader &r, volatile wiegandLine &line, bool bit, unsigned long m) {
+  byte n = r.bitCount;
+  if (n > 0 && m - r.lastPulseMicros < PULSE_SPACING_MIN_US) {
+    line.tooClose++;
+    return;
   }
+  if (n >= WIEGAND_MAX_BITS) {
+    r.overrun = true;
+    r.lastPulseMicros = m;
+    return;
+  }
+  if (n == 0) {
+    r.firstPulseMicros = m;
+    r.frameMaxGap = 0;
+  } else {
+    unsigned long gap = m - r.lastPulseMicros;
+    if (gap > 0xFFFF) gap = 0xFFFF;
+    if (gap > r.frameMaxGap) r.frameMaxGap = gap;
+  }
+  byte mask = 0x80 >> (n & 7);
+  if (bit) r.bits[n >> 3] |= mask;
+  else r.bits[n >> 3] &= ~mask;
+  r.bitCount = n + 1;
+  r.lastPulseMicros = m;
+}
+
+// Handles an edge on a Wiegand line: notes the time a pulse starts, and at its end
+// checks its width and stores the bit (false for the zero line, true for the one line).
+static inline void lineEdge(wiegandReader &r, bool bit, bool level, uint8_t slot) {
+  uint16_t now = TCNT4;
+  volatile wiegandLine &line = r.lines[bit];
+  if (!level) {
+    line.fallTicks = now;
+    line.low = true;
+    return;
+  }
+  if (!line.low) {
+    // The whole pulse went by while interrupts were held off, so its width is unknown.
+    // Keep it: it's far more likely a real bit than a glitch.
+    ISR_PROFILE_LATE(slot, true);
+    line.unmeasured++;
+    receiveBit(r, line, bit, micros());
+    return;
+  }
+  line.low = false;
+  uint16_t width = now - line.fallTicks;
+  if (width < PULSE_MIN_TICKS) line.tooShort++;
+  else if (width > PULSE_MAX_TICKS) line.tooLong++;
+  else receiveBit(r, line, bit, micros() - width / 2);
+}
+
+// Interrupt handlers for either edge on reader 0's zero and one lines
+static void zeroPulse() {
+  ISR_PROFILE_BEGIN(ISR_SLOT_WIEGAND0);
+  lineEdge(readers[0], false, PIND & _BV(3), ISR_SLOT_WIEGAND0); // pin 18 is PD3
+  ISR_PROFILE_END(ISR_SLOT_WIEGAND0);
 }
 
-// Interrupt handler for receiving a pulse on the one line.
-// Simply store the one ("true") and increase the counter of bits received (bitIndex)
 static void onePulse() {
-  if (bitIndex < 70) {
-    bitArray[bitIndex++] = true;
-    lastPulseTime = millis();
+  ISR_PROFILE_BEGIN(ISR_SLOT_WIEGAND1);
+  lineEdge(readers[0], true, PIND & _BV(2), ISR_SLOT_WIEGAND1); // pin 19 is PD2
+  ISR_PROFILE_END(ISR_SLOT_WIEGAND1);
+}
+
+// And reader 1's
+static void reader1ZeroPulse() {
+  ISR_PROFILE_BEGIN(ISR_SLOT_READER1_D0);
+  lineEdge(readers[1], false, PINE & _BV(4), ISR_SLOT_READER1_D0); // pin 2 is PE4
+  ISR_PROFILE_END(ISR_SLOT_READER1_D0);
+}
+
+static void reader1OnePulse() {
+  ISR_PROFILE_BEGIN(ISR_SLOT_READER1_D1);
+  lineEdge(readers[1], true, PINE & _BV(5), ISR_SLOT_READER1_D1); // pin 3 is PE5
+  ISR_PROFILE_END(ISR_SLOT_READER1_D1);
+}
+
+// True if a message is of a known format and its check bits are right: 8-bit keypad
+// (key, then its complement), or 26/34/37-bit cards with even parity over the first
+// half and odd parity over the last half (halves overlap by a bit at 37).
+static bool wiegandFormatValid(const wiegandFrame &f) {
+  byte bits = f.count;
+  if (bits == 8) {
+    byte v = f.bits[0];
+    return (v >> 4) == (~v & 0x0F);
+  }
+  if (bits != 26 && bits != 34 && bits != 37) return false;
+  byte half = (bits + 1) / 2;
+  byte even = 0, odd = 1;
+  for (byte i=0; i<half; i++) even ^= f.bit(i);
+  for (byte i=bits-half; i<bits; i++) odd ^= f.bit(i);
+  return even == 0 && odd == 0;
+}
+
+static unsigned long frameTimeoutMicros(const wiegandReader &r) {
+  unsigned long t = (unsigned long)r.learnedGap * WiegandGapMultiple;
+  if (r.learnedGap == 0 || t > WiegandTimeout * 1000UL) return WiegandTimeout * 1000UL;
+  if (t < WiegandMinTimeoutMicros) return WiegandMinTimeoutMicros;
+  return t;
+}
+
+// Takes the message a reader has received, if it is over, leaving the reader to
+// receive the next one.
+static bool takeFrame(wiegandReader &r, wiegandFrame &f) {
+  noInterrupts();
+  byte count = r.bitCount;
+  for (byte i=0; i<WIEGAND_BYTES; i++) f.bits[i] = r.bits[i];
+  f.firstPulse = r.firstPulseMicros;
+  f.lastPulse = r.lastPulseMicros;
+  uint16_t maxGap = r.frameMaxGap;
+  interrupts();
+  if (count == 0) return false;
+  f.count = count;
+
+  bool endOfFrame = (micros() - f.lastPulse) > frameTimeoutMicros(r);
+  // No need to wait out the timeout for a message as long as this reader's longest,
+  // that checks out.
+  if (!endOfFrame && count == r.learnedMaxBits && wiegandFormatValid(f)) endOfFrame = true;
+  if (!endOfFrame) return false;
+
+  noInterrupts();
+  if (r.bitCount != count) {
+    // Another bit came in since; the message isn't over after all.
+    interrupts();
+    return false;
+  }
+  r.bitCount = 0;
+  bool overrun = r.overrun;
+  r.overrun = false;
+  interrupts();
+
+  r.frames++;
+  r.bitsReceived += count;
+  if (overrun) {
+    r.overruns++;
+    return false;
+  }
+  if (count >= 4) {
+    // Learn this reader's timing.  The learned gap follows increases straight away,
+    // and decreases slowly, so one quick message can't make a slow reader's split.
+    if (maxGap >= r.learnedGap) r.learnedGap = maxGap;
+    else r.learnedGap -= (r.learnedGap - maxGap) / 8;
+    if (count > r.learnedMaxBits && wiegandFormatValid(f)) r.learnedMaxBits = count;
+  }
+  return true;
+}
+
+// The output protocols are bit-banged on pins fixed at compile time (see fastPin.h),
+// one copy per pin set, chosen in setup() for the translation option.
+//
+// Paxton output is clocked out by the Timer3 interrupt, every 200us, so it takes no
+// time from loop() and both Paxton outputs can send at once.  Each clock takes three
+// ticks: set data, clock low, clock high.  What's to be sent is queued as one bit per
+// clock (set for data low), and a run of idle clocks goes before and after messages.
+#define PAXTON_TX_CLOCKS 1024  // queue length, a power of two
+#define PAXTON_IDLE_CLOCKS 10
+
+struct paxtonTx {
+  volatile byte clocks[PAXTON_TX_CLOCKS / 8];
+  volatile uint16_t sent;   // clocks sent, wraps
+  volatile uint16_t queued; // clocks queued, wraps
+  byte phase;
+  bool driving;             // pins are outputs
+  void (*step)(paxtonTx &t);
+};
+
+template <class DATA, class CLOCK>
+static void paxtonTxStep(paxtonTx &t) {
+  uint16_t n = t.sent;
+  switch (t.phase) {
+  case 0:
+    if (n == t.queued) {
+      if (t.driving) {
+        DATA::inputPullup();
+        CLOCK::inputPullup();
+        t.driving = false;
+      }
+      return;
+    }
+    if (!t.driving) {
+      DATA::output();
+      CLOCK::output();
+      t.driving = true;
+    }
+    n %= PAXTON_TX_CLOCKS;
+    DATA::write(!(t.clocks[n >> 3] & (1 << (n & 7))));
+    t.phase = 1;
+    return;
+  case 1:
+    CLOCK::low();
+    t.phase = 2;
+    return;
+  default:
+    CLOCK::high();
+    t.sent = n + 1;
+    t.phase = 0;
+  }
+}
+
+// Sends a Wiegand message of up to 64 bits, most significant bit first
+template <class D0, class D1>
+static void wiegandOutOn(uint64_t message, byte bits) {
+  D0::output();
+  D1::output();
+  uint64_t bit = 1ULL << (bits - 1);
+  for (byte i=0; i<bits; i++) {
+    if (message & bit) {
+      D1::low();
+      delayMicroseconds(40);
+      D1::high();
+    } else {
+      D0::low();
+      delayMicroseconds(40);
+      D0::high();
+    }
+    delayMicroseconds(200);
+    bit >>= 1;
+  }
+  D0::inputPullup();
+  D1::inputPullup();
+}
+
+// Wiegand output formats.  The facility code and card number fields go out most
+// significant bit first.  With parity, they sit between a leading even parity bit over
+// the first half of the message and a trailing odd parity bit over the second half,
+// each half being (bits+1)/2 bits counting its parity bit, as wiegandFormatValid()
+// checks them.  The masks pick out the bits each parity bit covers, worked out by the
+// compiler from the message length.
+struct wiegandOutFormat {
+  byte bits;
+  byte facilityBits;
+  byte numberBits;
+  byte parity;        // 1 with parity bits, 0 without
+  uint64_t evenMask;  // fields the leading even parity bit covers
+  uint64_t oddMask;   // fields the trailing odd parity bit covers
+};
+
+static constexpr uint64_t lowBits(byte n) { return (1ULL << n) - 1; }
+
+static constexpr wiegandOutFormat parityFormat(byte bits, byte facilityBits) {
+  return { bits, facilityBits, (byte)(bits - 2 - facilityBits), 1,
+           lowBits(bits - 2) & ~lowBits(bits - 2 - ((bits + 1) / 2 - 1)),
+           lowBits((bits + 1) / 2 - 1) };
+}
+
+enum { wiegandOut32, wiegandOut26, wiegandOut34, wiegandOut37, wiegandOutKeypad, wiegandOutFormats };
+static const wiegandOutFormat wiegandFormats[wiegandOutFormats] PROGMEM = {
+  { 32, 0, 32, 0, 0, 0 },  // bare 32-bit card number, as translation option 14 has always sent
+  parityFormat(26, 8),     // H10301: 8-bit facility code, 16-bit card number
+  parityFormat(34, 16),    // 16-bit facility code, 16-bit card number
+  parityFormat(37, 16),    // H10304: 16-bit facility code, 19-bit card number
+  { 4, 0, 4, 0, 0, 0 },    // keypresses alongside the formats with parity
+};
+static byte wiegandFormat = wiegandOut32;
+
+static inline byte parity64(uint64_t x) {
+  uint32_t y = (uint32_t)x ^ (uint32_t)(x >> 32);
+  y ^= y >> 16;
+  y ^= y >> 8;
+  y ^= y >> 4;
+  y ^= y >> 2;
+  y ^= y >> 1;
+  return y & 1;
+}
+
+// Builds a message in format fmt.  Nothing here depends on the card number or on
+// whether the format has parity, so every message takes the same time to build.
+static uint64_t wiegandEncode(const wiegandOutFormat &fmt, uint32_t facility, uint32_t number) {
+  uint64_t fields = ((uint64_t)facility & lowBits(fmt.facilityBits)) << fmt.numberBits;
+  fields |= number & lowBits(fmt.numberBits);
+  uint64_t even = parity64(fields & fmt.evenMask);
+  uint64_t odd = parity64(fields & fmt.oddMask) ^ 1;
+  return (fields << fmt.parity) | (((even << (fmt.bits - 1)) | odd) & -(uint64_t)fmt.parity);
+}
+
+// Output channels: the pins messages are sent out on.  With translation option 214
+// there are two, for the Paxton's Reader 1 and Reader 2 ports.
+#define OUTPUT_CHANNELS 2
+struct outputChannel {
+  paxtonTx paxton;
+  void (*wiegandSend)(uint64_t message, byte bits);
+};
+static outputChannel outputs[OUTPUT_CHANNELS];
+static byte outputCount = 1;
+
+static void paxtonTxTick() {
+  for (byte i=0; i<outputCount; i++) {
+    paxtonTx &t = outputs[i].paxton;
+    if (t.step) t.step(t);
+  }
+}
+
+// Queues one clock.  Only loop() queues, and the interrupt doesn't read a clock until
+// queued has moved past it.
+static inline void paxtonQueueClock(paxtonTx &t, uint16_t &at, bool dataLow) {
+  uint16_t n = at++ % PAXTON_TX_CLOCKS;
+  if (dataLow) t.clocks[n >> 3] |= 1 << (n & 7);
+  else t.clocks[n >> 3] &= ~(1 << (n & 7));
+}
+
+// Queues frames messages of messageLength words each, back to back: one frame's
+// epilogue serves as the next one's preamble.
+static void paxtonProtocolSend(byte channel, byte messageLength, byte *message, byte frames=1) {
+  paxtonTx &t = outputs[channel].paxton;
+  uint16_t need = PAXTON_IDLE_CLOCKS + frames * ((messageLength + 1) * 5 + PAXTON_IDLE_CLOCKS);
+  if (!t.step || need > PAXTON_TX_CLOCKS) return;
+  uint16_t at;
+  for (;;) {
+    noInterrupts();
+    at = t.queued;
+    uint16_t used = at - t.sent;
+    interrupts();
+    if (PAXTON_TX_CLOCKS - used >= need) break;
+  }
+
+  for (byte i=0; i<PAXTON_IDLE_CLOCKS; i++) paxtonQueueClock(t, at, false);  // preamble
+  for (byte f=0; f<frames; f++) {
+    byte *m = &message[f * messageLength];
+    // calculate parity word, which will be sent after the message
+    byte messageparity = 0;
+    for (byte i=0; i<messageLength; i++) messageparity ^= m[i];
+
+    // Send the message (including a parity bit per word, and plus a parity word for the whole message)
+    for (byte i=0; i<=messageLength; i++) {
+      byte wordparity=1;
+      byte mr = (i==messageLength) ? messageparity : m[i];
+      for (byte j=0; j<5; j++) {
+        wordparity ^= (mr & 1);
+        if (j==4) mr=wordparity;
+        paxtonQueueClock(t, at, mr & 1);
+        mr>>=1;
+      }
+    }
+    for (byte i=0; i<PAXTON_IDLE_CLOCKS; i++) paxtonQueueClock(t, at, false);  // epilogue
+  }
+
+  noInterrupts();
+  t.queued = at;
+  interrupts();
+}
+
+// Timer3 in CTC mode at 2MHz, wrapping every 400 counts: 200us.  Drives the Paxton
+// output, and samples the LED input when it's on A2.  Also started by relayPrograms.
+void startTimer3() {
+  if (TIMSK3 & _BV(OCIE3A)) return;
+  TCCR3A = 0;
+  TCCR3B = _BV(WGM32) | _BV(CS31);
+  OCR3A = 399;
+  TIFR3 = _BV(OCF3A);
+  TIMSK3 |= _BV(OCIE3A);
+}
+
+// Routing: which Paxton port a message goes to, when there are two.
+#define ROUTE_SWITCH_PIN A3
+static byte routeOption;
+
+static byte routeFor(byte reader, bool keypress) {
+  if (outputCount < 2) return 0;
+  switch (routeOption) {
+  case 1: return reader & 1;                                 // by reader: 0/2 to Reader 1, 1/3 to Reader 2
+  case 2: return digitalRead(ROUTE_SWITCH_PIN) == LOW;       // privacy switch grounded: Reader 2
+  case 3: return keypress;                                   // keypad to Reader 2, cards to Reader 1
+  default: return 0;
   }
 }
 
 static bool using_paxton_protocol_to_net2_board = false;
 
+static void wiegandOut(byte format, uint32_t facility, uint32_t number) {
+  wiegandOutFormat fmt;
+  memcpy_P(&fmt, &wiegandFormats[format], sizeof(fmt));
+  outputs[0].wiegandSend(wiegandEncode(fmt, facility, number), fmt.bits);
+}
+
+// Sends a card out as Wiegand in the chosen format.  A card read from a reader in one
+// of the formats keeps its facility code and card number fields; any other card
+// number is cut to fit the fields as it is.  f is NULL for cards not read as Wiegand.
+static void wiegandCardOut(const wiegandFrame *f, uint32_t cardnumber) {
+  byte numberBits = pgm_read_byte(&wiegandFormats[wiegandFormat].numberBits);
+  uint32_t facility = (uint64_t)cardnumber >> numberBits;
+  uint32_t number = cardnumber;
+  if (f && wiegandFormat != wiegandOut32 && wiegandFormatValid(*f)) {
+    for (byte i=wiegandOut26; i<=wiegandOut37; i++) {
+      if (pgm_read_byte(&wiegandFormats[i].bits) != f->count) continue;
+      byte inNumberBits = pgm_read_byte(&wiegandFormats[i].numberBits);
+      uint64_t fields = 0;
+      for (byte b=1; b<f->count-1; b++) fields = (fields << 1) | f->bit(b);
+      facility = fields >> inNumberBits;
+      number = fields & lowBits(inNumberBits);
+    }
+  }
+  wiegandOut(wiegandFormat, facility, number);
+}
 
+// Keys go out as 4 bits alongside the formats with parity, and as 32 bits with option 14.
+static void wiegandKeyOut(byte key) {
+  wiegandOut(wiegandFormat == wiegandOut32 ? wiegandOut32 : wiegandOutKeypad, 0, key);
+}
 
-static void translateWiegand::setup() {
 
-  translationOption = eepromconfig::get_translationoption();
-  char smsg[200];
+// Many readers send a card again and again while it sits on the reader.  Cards sent
+// recently are remembered, and the same card within the hold-off is dropped.  A dropped
+// repeat restarts the hold-off, so a card left on the reader is only sent once.
+#define RECENT_CARDS 4
+struct recentCard {
+  uint32_t card;
+  unsigned long when;  // millis()
+};
+static recentCard recentCards[RECENT_CARDS];
+static byte nextRecentCard;
+static unsigned long duplicateHoldoffMs;  // 0 = off
+static uint16_t cardsSent, duplicatesDropped;
 
-  // avoid allocating the display pages if the option isn't active.
-  switch (translationOption) {
-    case 14: case 114: case 160: break;
-    default: return;
+// Returns true if card was sent within the hold-off, otherwise remembers it as sent now.
+static bool isDuplicateCard(uint32_t card) {
+  if (!duplicateHoldoffMs) return false;
+  unsigned long m = millis();
+  for (byte i=0; i<RECENT_CARDS; i++) {
+    recentCard &r = recentCards[i];
+    if (r.card == card && r.when && m - r.when < duplicateHoldoffMs) {
+      r.when = m;
+      duplicatesDropped++;
+      return true;
+    }
+  }
+  recentCard &r = recentCards[nextRecentCard];
+  nextRecentCard = (nextRecentCard + 1) % RECENT_CARDS;
+  r.card = card;
+  r.when = m | 1;  // never 0, which marks an empty entry
+  cardsSent++;
+  return false;
+}
+
+static void sendPinEntry(byte n) {
+  wiegandReader &r = readers[n];
+  r.pinEntry[r.pinLength++] = 11;  // #
+  paxtonKeypressesOut(routeFor(n, true), r.pinEntry, r.pinLength);
+  r.pinLength = 0;
+}
+
+// Adds a key (0-11 as sent by the reader) to the reader's PIN entry.  Returns true
+// when the entry is complete.
+static bool pinKey(wiegandReader &r, byte key) {
+  if (key == 10) {  // * clears
+    r.pinLength = 0;
+    return false;
+  }
+  if (key == 11) return true;
+  r.pinEntry[r.pinLength++] = key;
+  r.pinLastKeyWhen = millis();
+  return r.pinLength >= pinMaxLength;
+}
+
+static void translateWiegand::printDuplicates() {
+  Serial.print(F("Duplicate card hold-off "));
+  Serial.print(duplicateHoldoffMs);
+  Serial.print(F("ms, cards sent "));
+  Serial.print(cardsSent);
+  Serial.print(F(", duplicates dropped "));
+  Serial.println(duplicatesDropped);
+}
+
+
+// Swipe tracing: a micros() timestamp for each stage a message goes through, from
+// its first Wiegand edge to the end of what we send on.  The last few are kept for
+// the TRACE serial command, and the time between stages goes into histograms.
+enum { stageFirstEdge, stageLastEdge, stageEndOfFrame, stageDecoded, stageSendStart, stageSendEnd, STAGES };
+static const char PROGMEM stageName0[] = "First edge to last edge";
+static const char PROGMEM stageName1[] = "Last edge to end of frame";
+static const char PROGMEM stageName2[] = "End of frame to decoded";
+static const char PROGMEM stageName3[] = "Decoded to send start";
+static const char PROGMEM stageName4[] = "Send start to send end";
+static const char PROGMEM stageName5[] = "Overall, first edge to send end";
+static const char * const stageNames[STAGES] PROGMEM = { stageName0, stageName1, stageName2, stageName3, stageName4, stageName5 };
+
+#define TRACE_COUNT 8
+struct swipeTrace {
+  uint32_t t[STAGES];
+  byte bits;
+  byte reader;
+};
+static swipeTrace traces[TRACE_COUNT];
+static byte traceCount=0; // total, wraps
+static swipeTrace currentTrace;
+// stage i to i+1 in [i], and first edge to send end in [STAGES-1]
+static latencyHistogram stageHistograms[STAGES];
+
+static inline void traceStage(byte stage) {
+  currentTrace.t[stage] = micros();
+}
+
+static void recordTrace(swipeTrace &t) {
+  t.t[stageSendEnd] = micros();
+  traces[traceCount++ % TRACE_COUNT] = t;
+  for (byte i=0; i<STAGES-1; i++) stageHistograms[i].add(t.t[i+1] - t.t[i]);
+  stageHistograms[STAGES-1].add(t.t[stageSendEnd] - t.t[stageFirstEdge]);
+}
+
+static void finishTrace() {
+  recordTrace(currentTrace);
+}
+
+// Paxton messages are sent from the Timer3 interrupt, so their traces are finished
+// once the output has caught up with them.
+#define PENDING_SENDS 4
+struct pendingSend {
+  swipeTrace trace;
+  uint16_t endClock;  // paxtonTx::queued after the message
+  uint32_t card;      // 0 for keypresses
+};
+static pendingSend pendingSends[OUTPUT_CHANNELS][PENDING_SENDS];
+static byte pendingCount[OUTPUT_CHANNELS];
+
+static void finishPendingSends() {
+  for (byte c=0; c<outputCount; c++) {
+    noInterrupts();
+    uint16_t sent = outputs[c].paxton.sent;
+    interrupts();
+    while (pendingCount[c]) {
+      pendingSend &p = pendingSends[c][0];
+      if ((int16_t)(sent - p.endClock) < 0) break;
+      recordTrace(p.trace);
+      // The ACU's verdict comes back on the LED of Reader 1.
+      if (p.card && c == 0) accessVerdict::cardSent(p.card, (p.trace.t[stageSendEnd] - p.trace.t[stageLastEdge]) / 1000);
+      pendingCount[c]--;
+      for (byte i=0; i<pendingCount[c]; i++) pendingSends[c][i] = pendingSends[c][i+1];
+    }
+  }
+}
+
+static void finishTraceWhenSent(byte channel, uint32_t card) {
+  while (pendingCount[channel] == PENDING_SENDS) finishPendingSends();
+  pendingSend &p = pendingSends[channel][pendingCount[channel]++];
+  p.trace = currentTrace;
+  p.endClock = outputs[channel].paxton.queued;
+  p.card = card;
+}
+
+static void translateWiegand::printNoise() {
+  if (!feature_enabled) {
+    Serial.println(F("Wiegand input not in use"));
+    return;
+  }
+  Serial.println(F("Rejected pulses: too short, too long, too close; kept unmeasured"));
+  for (byte i=0; i<readerCount*2; i++) {
+    volatile wiegandLine &line = readers[i/2].lines[i%2];
+    noInterrupts();
+    uint16_t tooShort = line.tooShort;
+    uint16_t tooLong = line.tooLong;
+    uint16_t tooClose = line.tooClose;
+    uint16_t unmeasured = line.unmeasured;
+    interrupts();
+    Serial.print(F("Reader "));
+    Serial.print(i/2);
+    Serial.print(i%2 ? F(" D1: ") : F(" D0: "));
+    Serial.print(tooShort);
+    Serial.print(F(", "));
+    Serial.print(tooLong);
+    Serial.print(F(", "));
+    Serial.print(tooClose);
+    Serial.print(F("; "));
+    Serial.println(unmeasured);
+  }
+}
+
+static void translateWiegand::printReaders() {
+  if (!feature_enabled) {
+    Serial.println(F("Wiegand input not in use"));
+    return;
   }
+  for (byte i=0; i<readerCount; i++) {
+    wiegandReader &r = readers[i];
+    Serial.print(F("Reader "));
+    Serial.print(i);
+    Serial.print(F(": "));
+    Serial.print(r.frames);
+    Serial.print(F(" messages, "));
+    Serial.print(r.bitsReceived);
+    Serial.print(F(" bits; lost "));
+    Serial.print(r.overruns);
+    Serial.print(F(" too long, "));
+    Serial.print(r.rejected);
+    Serial.println(F(" unknown length"));
+    Serial.print(F("  learned bit gap "));
+    Serial.print(r.learnedGap);
+    Serial.print(F("us, end of frame after "));
+    Serial.print(frameTimeoutMicros(r));
+    Serial.print(F("us, longest message "));
+    Serial.print(r.learnedMaxBits);
+    Serial.println(F(" bits"));
+  }
+}
+
+static void translateWiegand::printTrace() {
+  byte n = traceCount < TRACE_COUNT ? traceCount : TRACE_COUNT;
+  Serial.println(F("Recent messages, us after first edge: last edge, end of frame, decoded, send start, send end"));
+  for (byte i=n; i>0; i--) {
+    swipeTrace &t = traces[(byte)(traceCount - i) % TRACE_COUNT];
+    Serial.print('R');
+    Serial.print(t.reader);
+    Serial.print(' ');
+    Serial.print(t.bits);
+    Serial.print(F(" bits:"));
+    for (byte s=stageLastEdge; s<STAGES; s++) {
+      Serial.print(' ');
+      Serial.print(t.t[s] - t.t[stageFirstEdge]);
+    }
+    Serial.println();
+  }
+  for (byte i=0; i<STAGES; i++) {
+    stageHistograms[i].print((const __FlashStringHelper*)pgm_read_ptr(&stageNames[i]), F("us"));
+  }
+}
+
+
+// LED mirror: the Paxton's LED output (GPIO50 or A2, LOW = on) is copied, inverted, to
+// the reader's LED line on GPIO12 (driven LOW, or released to its pullup).  It is done
+// from an interrupt so the Net2's flash sequences come through exactly:
+// GPIO50 (PB3) has a pin change interrupt.  A2 has none, so for it Timer3 samples
+// the pin every 200us instead.
+static volatile uint8_t *ledInPin;
+static uint8_t ledInMask;
+static volatile uint8_t *ledOutDdr;
+static volatile uint8_t *ledOutPort;
+static uint8_t ledOutMask;
+static uint8_t ledLastLevel;
+
+// The most recent LED input edges, for the LED serial command
+#define LED_EDGE_COUNT 16
+struct ledEdge {
+  uint32_t when;  // micros()
+  bool on;
+};
+static volatile ledEdge ledEdges[LED_EDGE_COUNT];
+static volatile byte ledEdgeCount=0; // total, wraps
+
+// Copies the LED input to the output, and records an edge if it changed.
+// Called with interrupts off.
+static inline void mirrorLed() {
+  uint8_t level = *ledInPin & ledInMask;
+  if (!readerFeedback::ownsLed()) {
+    if (level == 0) {
+      *ledOutDdr &= ~ledOutMask;
+      *ledOutPort |= ledOutMask;
+    } else {
+      *ledOutPort &= ~ledOutMask;
+      *ledOutDdr |= ledOutMask;
+    }
+  }
+  if (level == ledLastLevel) return;
+  ledLastLevel = level;
+  volatile ledEdge &e = ledEdges[ledEdgeCount % LED_EDGE_COUNT];
+  e.when = micros();
+  e.on = (level == 0);
+  ledEdgeCount++;
+}
+
+// Readers 2 and 3 share the PCINT0 group with the LED input.  Lines are told apart by
+// which pins changed since last time; only the reader lines enabled in PCMSK0 count.
+static uint8_t lastPinb;
+
+static void translateWiegand::pcint0_isr() {
+  uint8_t pinb = PINB;
+  uint8_t changed = (pinb ^ lastPinb) & PCMSK0;
+  lastPinb = pinb;
+  if (changed & _BV(0)) lineEdge(readers[2], false, pinb & _BV(0), ISR_SLOT_PCINT0); // GPIO53
+  if (changed & _BV(1)) lineEdge(readers[2], true, pinb & _BV(1), ISR_SLOT_PCINT0);  // GPIO52
+  if (changed & _BV(2)) lineEdge(readers[3], false, pinb & _BV(2), ISR_SLOT_PCINT0); // GPIO51
+  if (changed & _BV(4)) lineEdge(readers[3], true, pinb & _BV(4), ISR_SLOT_PCINT0);  // GPIO10
+  if (ledInPin) mirrorLed();
+}
+
+static bool ledSampled;  // the LED input is sampled by Timer3
+
+static void translateWiegand::timer3_compA_isr() {
+  if (ledSampled) mirrorLed();
+  paxtonTxTick();
+}
+
+static void startLedMirror() {
+  uint8_t port = digitalPinToPort(LEDOutputPin);
+  ledOutDdr = portModeRegister(port);
+  ledOutPort = portOutputRegister(port);
+  ledOutMask = digitalPinToBitMask(LEDOutputPin);
+  ledInMask = digitalPinToBitMask(LEDInputPin);
+
+  noInterrupts();
+  ledInPin = portInputRegister(digitalPinToPort(LEDInputPin));
+  ledLastLevel = *ledInPin & ledInMask;
+  mirrorLed();
+  if (LEDInputPin == 50) {
+    if (!(PCICR & _BV(PCIE0))) lastPinb = PINB;  // readers 2-3 seed it when they start
+    PCMSK0 |= _BV(PCINT3);
+    PCIFR = _BV(PCIF0);
+    PCICR |= _BV(PCIE0);
+  } else {
+    ledSampled = true;
+    startTimer3();
+  }
+  interrupts();
+}
+
+static byte translateWiegand::ledEdgeTotal() {
+  return ledEdgeCount;
+}
+
+static bool translateWiegand::getLedEdge(byte n, uint32_t *when, bool *on) {
+  noInterrupts();
+  bool inRing = (byte)(ledEdgeCount - n - 1) < LED_EDGE_COUNT;
+  volatile ledEdge &e = ledEdges[n % LED_EDGE_COUNT];
+  *when = e.when;
+  *on = e.on;
+  interrupts();
+  return inRing;
+}
+
+static bool translateWiegand::ledIsOn() {
+  return ledInPin && (*ledInPin & ledInMask) == 0;
+}
+
+static void translateWiegand::printLedEdges() {
+  ledEdge e[LED_EDGE_COUNT];
+  noInterrupts();
+  byte count = ledEdgeCount;
+  for (byte i=0; i<LED_EDGE_COUNT; i++) e[i].when = ledEdges[i].when, e[i].on = ledEdges[i].on;
+  interrupts();
+
+  byte n = count < LED_EDGE_COUNT ? count : LED_EDGE_COUNT;
+  Serial.print(F("Last "));
+  Serial.print(n);
+  Serial.println(F(" LED input edges, oldest first (us after previous):"));
+  for (byte i=n; i>0; i--) {
+    byte idx = (byte)(count - i) % LED_EDGE_COUNT;
+    Serial.print(e[idx].on ? F("on  ") : F("off "));
+    if (i < n) Serial.print(e[idx].when - e[(byte)(count - i - 1) % LED_EDGE_COUNT].when);
+    Serial.println();
+  }
+}
+
 
-  displayPage *dp1 = new displayPage(F("Card Reader / Keypad\ntranslation active.\n\nHold for details"));
-  displayPage *dp2 = dp1->addLongPressDisplayPage(new displayPage(F("Converts Wiegand RFID\ninto Paxton Reader\nformat (card/keypad).\nMore info tap button.")));
+
+static void translateWiegand::setup() {
+
+  translationOption = eepromconfig::get_translationoption();
+  duplicateHoldoffMs = eepromconfig::get_duplicate_holdoff() * 100UL;
+  readerCount = eepromconfig::get_reader_count();
+  pinMaxLength = eepromconfig::get_pin_entry_option();
+  if (pinMaxLength > PIN_MAX_LENGTH) pinMaxLength = PIN_MAX_LENGTH;
 
   switch (translationOption) {
 // Translation option 14: Wiegand to Wiegand32 out GPIO14/15
+// Translation options 26, 34, 37: Wiegand to Wiegand 26 (H10301), 34 or 37 (H10304) bits
+//   with parity out GPIO14/15
 // Translation option 114: Wiegand to Paxton out GPIO14/15, LED in GPIO50 and ~out GPIO12
+// Translation option 149: Paxton reader in GPIO42/49 (and Wiegand) to Wiegand32 out GPIO14/15
 // Translation option 160: Wiegand to Paxton out A0/A1, LED in A2 and ~out GPIO12
+// Translation option 214: Wiegand to Paxton Reader 1 out GPIO14/15 and Reader 2 out A0/A1,
+//   LED (Reader 1) in GPIO50 and ~out GPIO12
   case 14:
-    sprintf_P(smsg, PSTR("Wiegand program 14:\n to Wiegand32,\ninputs GPIO %d,%d\noutputs GPIO %d,%d"), 
-      Wiegand0InputPin,Wiegand1InputPin,Wiegand0OutputPin,Wiegand1OutputPin);
-    dp2->addDisplayPage(new displayPage(smsg));
-
+    outputs[0].wiegandSend = wiegandOutOn<fastPin14, fastPin15>;
+    outputs[0].paxton.step = paxtonTxStep<fastPin14, fastPin15>;
     break;
   case 114:
-    dp2->addDisplayPage(new displayPage(F("Wiegand program 114:\n Wiegand card reader:\nConnect D0/D1/LED\n to GPIO 18/19/12")));
-    dp2->addDisplayPage(new displayPage(F("Wiegand program 114:\n to Paxton protocol:\n Net2 Data/Clk/RedLED\n connects to 14/15/50")));
+    outputs[0].paxton.step = paxtonTxStep<fastPin14, fastPin15>;
     using_paxton_protocol_to_net2_board = true;
     LEDOutputPin = 12;
     pinMode(LEDInputPin, INPUT_PULLUP);
     usingPaxtonReaderProtocol=true;
     break;
+  case 26:
+  case 34:
+  case 37:
+    outputs[0].wiegandSend = wiegandOutOn<fastPin14, fastPin15>;
+    wiegandFormat = translationOption == 26 ? wiegandOut26 : translationOption == 34 ? wiegandOut34 : wiegandOut37;
+    break;
+  case 149:
+    outputs[0].wiegandSend = wiegandOutOn<fastPin14, fastPin15>;
+    usingPaxtonReaderInput=true;
+    break;
   case 160:
-    dp2->addDisplayPage(new displayPage(F("Wiegand program 160:\n Wiegand card reader:\nConnect D0/D1/LED\n to GPIO 18/19/12")));
-    dp2->addDisplayPage(new displayPage(F("Wiegand program 160\n to Paxton Reader:\n Net2 Data/Clk/RedLED\n connects to A0/A1/A2")));
     using_paxton_protocol_to_net2_board = true;
     LEDInputPin = A2;
     LEDOutputPin = 12;
     pinMode(LEDInputPin, INPUT_PULLUP);
     PaxtonDataOutputPin = A0;
     PaxtonClockOutputPin = A1;
+    outputs[0].paxton.step = paxtonTxStep<fastPinA0, fastPinA1>;
+    usingPaxtonReaderProtocol=true;
+    break;
+  case 214:
+    using_paxton_protocol_to_net2_board = true;
+    LEDOutputPin = 12;
+    pinMode(LEDInputPin, INPUT_PULLUP);
+    outputs[0].paxton.step = paxtonTxStep<fastPin14, fastPin15>;
+    outputs[1].paxton.step = paxtonTxStep<fastPinA0, fastPinA1>;
+    outputCount = 2;
+    pinMode(A0, INPUT_PULLUP);
+    pinMode(A1, INPUT_PULLUP);
+    routeOption = eepromconfig::get_route_option();
+    if (routeOption == 2) pinMode(ROUTE_SWITCH_PIN, INPUT_PULLUP);
     usingPaxtonReaderProtocol=true;
     break;
   default:
     return;
   }
-  addDisplayPage(dp1);
+  feature_enabled=true;
+  strcpy_P(pageArena.wiegandDiagnostics, PSTR("Press a key or\nswipe a card to test"));
 
-  wiegandDiagnosticsPage = new displayPage(F("Card Reader Test\n\nPress a key or\nswipe a card to test"));
-  diagnosticsPage->addDisplayPage(wiegandDiagnosticsPage);
 
-  
-  pinMode(Wiegand0InputPin, INPUT_PULLUP);
-  pinMode(Wiegand1InputPin, INPUT_PULLUP);
+  // With OSDP on, USART1 has reader 0's pins.
+  if (!osdp::feature_enabled) {
+    pinMode(Wiegand0InputPin, INPUT_PULLUP);
+    pinMode(Wiegand1InputPin, INPUT_PULLUP);
+  }
   // Leaving the outputs in "input pullup" mode while idle, to minimize potential
   // for damage in case of short circuits or miswiring.  Input_pullup looks
   // like "HIGH" to the Paxton, which it will treat as idle.
@@ -129,211 +970,278 @@ static void translateWiegand::setup() {
   pinMode(Wiegand1OutputPin, INPUT_PULLUP);
   // Reminder that PaxtonDataOutputPin and PaxtonClockOutputPin are the same as Wiegand0/1 pins.
 
-  // Attach interrupt handlers to pins so we are notified when they receive a "falling" pulse
-  attachInterrupt(digitalPinToInterrupt(Wiegand0InputPin), zeroPulse, FALLING);
-  attachInterrupt(digitalPinToInterrupt(Wiegand1InputPin), onePulse, FALLING);
+  if (outputs[0].paxton.step) {
+    noInterrupts();
+    startTimer3();
+    interrupts();
+  }
 
-}
+  // Timer4 free running at 2MHz, for timing the pulses.  It wraps every 32.768ms.
+  TCCR4A = 0;
+  TCCR4B = _BV(CS41);
+  TCCR4C = 0;
+  TIMSK4 = 0;
+  if (usingPaxtonReaderInput) paxtonReceiver::begin(true);
 
+  // Attach interrupt handlers to pins so we are notified of both edges of each pulse
+  if (!osdp::feature_enabled) {
+    attachInterrupt(digitalPinToInterrupt(Wiegand0InputPin), zeroPulse, CHANGE);
+    attachInterrupt(digitalPinToInterrupt(Wiegand1InputPin), onePulse, CHANGE);
+  }
 
+  if (readerCount > 1) {
+    pinMode(2, INPUT_PULLUP);
+    pinMode(3, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(2), reader1ZeroPulse, CHANGE);
+    attachInterrupt(digitalPinToInterrupt(3), reader1OnePulse, CHANGE);
+  }
+  if (readerCount > 2) {
+    pinMode(53, INPUT_PULLUP);
+    pinMode(52, INPUT_PULLUP);
+    uint8_t mask = _BV(PCINT0) | _BV(PCINT1);
+    if (readerCount > 3) {
+      pinMode(51, INPUT_PULLUP);
+      pinMode(10, INPUT_PULLUP);
+      mask |= _BV(PCINT2) | _BV(PCINT4);
+    }
+    noInterrupts();
+    lastPinb = PINB;
+    PCMSK0 |= mask;
+    PCIFR = _BV(PCIF0);
+    PCICR |= _BV(PCIE0);
+    interrupts();
+  }
 
-static void translateWiegand::loop() {
+  if (LEDOutputPin != -1) startLedMirror();
+}
 
 
-  //
-  // Show diagnostic data on Card Reader diagnostic screen
-  //
-  static byte lastMessageSize;
-  static long lastMessageWhen;
-  static bool showingLastMessage;
-  static __FlashStringHelper *lastMessageKind = F("Last event");
-  static int lastSecondCount;
-  if (showingLastMessage) {
-    long m = millis();
-    if (m - lastMessageWhen > 300000) showingLastMessage=false;
-    else {
-      static char* diagmsg;
-      if (diagmsg==NULL) diagmsg=malloc(60);
-      int secondCount = (m - lastMessageWhen) / 1000L;
-      if (lastSecondCount != secondCount) {
-        lastSecondCount = secondCount;
-        strcpy_P(diagmsg, (const char*)lastMessageKind);
-        sprintf_P(&diagmsg[strlen(diagmsg)], PSTR(" received:\n%d bits %d sec ago"),lastMessageSize, lastSecondCount);
-        wiegandDiagnosticsPage->msg=diagmsg;
-        wiegandDiagnosticsPage->rommsg=PSTR("Card Reader Test\n\n");
-      }
-    }
-  } 
 
-  if (LEDOutputPin != -1) {
-    if (digitalRead(LEDInputPin)==LOW) {
-      pinMode(LEDOutputPin, INPUT_PULLUP);
-    } else {
-      pinMode(LEDOutputPin, OUTPUT);
-      digitalWrite(LEDOutputPin, LOW);
+// Shown on the Card Reader diagnostic screen
+static byte lastMessageSize;
+static uint32_t lastMessageWhen;
+static bool showingLastMessage;
+static const __FlashStringHelper *lastMessageKind;
+static int lastSecondCount;
+
+// Decodes a message from reader n and sends it on.
+static void processFrame(byte n, const wiegandFrame &f) {
+  wiegandReader &r = readers[n];
+  currentTrace.t[stageFirstEdge] = f.firstPulse;
+  currentTrace.t[stageLastEdge] = f.lastPulse;
+  currentTrace.bits = f.count;
+  currentTrace.reader = n;
+  traceStage(stageEndOfFrame);
+  uint64_t message = 0;
+  if (f.count >= 4) {
+    // Process an incoming Wiegand message
+    Serial.print("Got a ");
+    Serial.print(f.count);
+    Serial.print(" bit Wiegand message: ");
+    for (byte i=0; i<f.count; i++) {
+      Serial.print(f.bit(i) ? 1 : 0);
+      message <<= 1;
+      if (f.bit(i)) message++;
     }
-//    digitalWrite(ledOutputPin, digitalRead(ledInputPin)==LOW ? HIGH : LOW);
+    Serial.println();
   }
 
-  // Look for new Wiegand messages
-  if (bitIndex > 0 && (millis() - lastPulseTime) > WiegandTimeout) {
-    uint64_t message = 0;
-    if (bitIndex >= 4) {
-      // Process an incoming Wiegand message
-      Serial.print("Got a ");
-      Serial.print(bitIndex);
-      Serial.print(" bit Wiegand message: ");
-      for (int i=0; i<bitIndex; i++) {
-        Serial.print(bitArray[i] ? 1 : 0);
-        message <<= 1;
-        if (bitArray[i]) message++;      
-      }
-      Serial.println();
-    }
+  // 8-bit keypad messages are the key, with its complement ahead of it.
+  bool keypress = f.count == 4;
+  if (f.count == 8 && wiegandFormatValid(f)) {
+    keypress = true;
+    message &= 0x0F;
+  }
 
-    if (bitIndex >= 4) {
-      lastMessageSize = bitIndex;
-      lastMessageWhen = millis();
-      showingLastMessage = true;
-      lastSecondCount=-1;
-      if (bitIndex==4) {
-        switch (message) {
-        case 10: lastMessageKind = F("*/ESC key"); break;
-        case 11: lastMessageKind = F("#/Enter key"); break;
-        case 12: lastMessageKind = F("Bell key"); break;
-        case 13: case 14: case 15: lastMessageKind = F("Other key"); break;
-        default: lastMessageKind = F("Digit key"); break;
-        }
-      } else {
-        lastMessageKind = F("Card swipe");
+  if (f.count >= 4) {
+    lastMessageSize = f.count;
+    lastMessageWhen = millis();
+    showingLastMessage = true;
+    lastSecondCount=-1;
+    if (keypress) {
+      switch (message) {
+      case 10: lastMessageKind = F("*/ESC key"); break;
+      case 11: lastMessageKind = F("#/Enter key"); break;
+      case 12: lastMessageKind = F("Bell key"); break;
+      case 13: case 14: case 15: lastMessageKind = F("Other key"); break;
+      default: lastMessageKind = F("Digit key"); break;
       }
+    } else {
+      lastMessageKind = F("Card swipe");
     }
+  }
 
-    if (bitIndex==26) { // save the bottom 24 bits... highest number 16777216, always below 8 digits
-      message &= 0x1FFFFFE;
-      message >>= 1;
-    } else if (bitIndex == 35) { // HID 35 bit, Cherry-pick the 20 bits we want, discard the rest.
-      message &= 0x1FFFFE;
-      message >>= 1;
-    } else if (bitIndex==34) {
-      // Wiegand34, we'll take the inner 32 thanks
-      message &= 0x1FFFFFFFEUL;
-      message >>= 1;
-    } else if (bitIndex==36) {
-      // Wiegand34 with ibutton detection, discard the first two bits (plus first and last parity bits)
-      message &= 0x1FFFFFFFEUL;
-      message >>= 1;  
-    } else if (bitIndex != 4 && bitIndex < 26) {
-      // unwanted message, probably noise.
-      bitIndex=0;
-      return;
-    }
+  if (f.count==26) { // save the bottom 24 bits... highest number 16777216, always below 8 digits
+    message &= 0x1FFFFFE;
+    message >>= 1;
+  } else if (f.count == 35) { // HID 35 bit, Cherry-pick the 20 bits we want, discard the rest.
+    message &= 0x1FFFFE;
+    message >>= 1;
+  } else if (f.count==34) {
+    // Wiegand34, we'll take the inner 32 thanks
+    message &= 0x1FFFFFFFEUL;
+    message >>= 1;
+  } else if (f.count==36) {
+    // Wiegand34 with ibutton detection, discard the first two bits (plus first and last parity bits)
+    message &= 0x1FFFFFFFEUL;
+    message >>= 1;  
+  } else if (!keypress && f.count < 26) {
+    // unwanted message, probably noise.
+    r.rejected++;
+    return;
+  }
 
 
 
-    message = message % 100000000; // Keep only the smallest 8 decimal digits.
-    uint32_t message32 = message;
-    Serial.print(F("The card number is "));
-    Serial.println(message32);
+  message = message % 100000000; // Keep only the smallest 8 decimal digits.
+  uint32_t message32 = message;
+  Serial.print(F("The card number is "));
+  Serial.println(message32);
 
-    if (usingPaxtonReaderProtocol) {
-      if (bitIndex==4 && message32 < 13) {
-        bool handled=false;
-        if (message32==10 && star_key_handler != NULL) handled = (*star_key_handler)();
-        if (!handled) paxtonKeypressOut(PaxtonDataOutputPin, PaxtonClockOutputPin, message32);
-      } else if (bitIndex >= 26 && message32 != 0) {
-        paxtonReaderOut(PaxtonDataOutputPin, PaxtonClockOutputPin, message32);
-      }
-      bitIndex=0;
-      message32=0;
-      return;
-    }
+  // Facility code 0 with PIN entry on: a reader sending a whole PIN as a card number
+  bool pinAsCard = usingPaxtonReaderProtocol && pinMaxLength && f.count == 26 && message32 <= 0xFFFF;
+
+  if (f.count >= 26 && message32 != 0 && !pinAsCard && isDuplicateCard(message32)) {
+    Serial.println(F("Same card again, dropped"));
+    return;
+  }
+
+  traceStage(stageDecoded);
+
+  // A key that a subscriber handled (leftOpenBeep takes *) goes no further.
+  if (keypress) {
+    if (eventBus::publish(busKey, message32 | ((uint32_t)n << 8))) return;
+  } else if (!pinAsCard && message32 != 0) {
+    eventBus::publish(busCard, message32);
+  }
 
-    if (message32 != 0) { // do not allow a message of cardnumber 0, Paxton doesn't like this
-
-      // Send the modified Wiegand message out the Wiegand output pins.
-      // The out message will always be exactly 32 bits.
-      pinMode(Wiegand0OutputPin, OUTPUT);
-      pinMode(Wiegand1OutputPin, OUTPUT);
-      for (int i=0; i<32; i++) {
-          if (message32 & 0x80000000) {
-            digitalWrite(Wiegand1OutputPin, LOW);
-            delayMicroseconds(40);
-            digitalWrite(Wiegand1OutputPin, HIGH);
-            delayMicroseconds(200);
-          } else {
-            digitalWrite(Wiegand0OutputPin, LOW);
-            delayMicroseconds(40);
-            digitalWrite(Wiegand0OutputPin, HIGH);
-            delayMicroseconds(200);
-          }
-          message32 <<= 1;
+  if (usingPaxtonReaderProtocol) {
+    byte channel = routeFor(n, keypress || pinAsCard);
+    if (keypress && message32 < 13) {
+      if (pinMaxLength && message32 != 12 && (r.pinLength || message32 != 10)) {
+        // Part of a PIN entry.  A * with nothing entered still goes straight through.
+        if (pinKey(r, message32)) {
+          traceStage(stageSendStart);
+          sendPinEntry(n);
+          finishTraceWhenSent(channel, 0);
+        }
+      } else {
+        traceStage(stageSendStart);
+        paxtonKeypressOut(channel, message32);
+        finishTraceWhenSent(channel, 0);
       }
-      pinMode(Wiegand0OutputPin, INPUT_PULLUP);
-      pinMode(Wiegand1OutputPin, INPUT_PULLUP);
-      bitIndex=0;
+    } else if (pinAsCard) {
+      r.pinLength = 0;
+      do {
+        r.pinEntry[r.pinLength++] = message32 % 10;
+        message32 /= 10;
+      } while (message32 && r.pinLength < PIN_MAX_LENGTH);
+      for (byte i=0, j=r.pinLength-1; i<j; i++, j--) {
+        char c = r.pinEntry[i];
+        r.pinEntry[i] = r.pinEntry[j];
+        r.pinEntry[j] = c;
+      }
+      traceStage(stageSendStart);
+      sendPinEntry(n);
+      finishTraceWhenSent(channel, 0);
+    } else if (f.count >= 26 && message32 != 0) {
+      traceStage(stageSendStart);
+      paxtonReaderOut(channel, message32);
+      finishTraceWhenSent(channel, message32);
     }
-    bitIndex=0;
+    return;
+  }
+
+  if (message32 != 0) { // do not allow a message of cardnumber 0, Paxton doesn't like this
+
+    // Send the modified Wiegand message out the Wiegand output pins, in the
+    // format chosen by the translation option.
+    traceStage(stageSendStart);
+    if (keypress) wiegandKeyOut(message32);
+    else wiegandCardOut(&f, message32);
+    finishTrace();
   }
 }
 
 
-static void paxtonProtocolSend(byte pindata, byte pinclock, byte messageLength, byte *message) {
-    pinMode(PaxtonDataOutputPin, OUTPUT);
-    pinMode(PaxtonClockOutputPin, OUTPUT);
+static void translateWiegand::receiveFrame(byte n, const byte *bits, byte count) {
+  if (!feature_enabled || n >= WIEGAND_READERS || count > WIEGAND_MAX_BITS) return;
+  wiegandFrame f;
+  memcpy(f.bits, bits, (count + 7) / 8);
+  f.count = count;
+  f.firstPulse = f.lastPulse = micros();
+  readers[n].frames++;
+  readers[n].bitsReceived += count;
+  processFrame(n, f);
+}
 
 
-  // calculate parity word, which will be sent after the message
-  byte messageparity = 0;
-  for (byte i=0; i<messageLength; i++) messageparity ^= message[i];
+static void translateWiegand::loop() {
 
-  // Write preamble, which is ten clocks with data high
-  digitalWrite(pindata, HIGH);
-  for (byte i=0; i<10; i++) {
-    delayMicroseconds(200);
-    digitalWrite(pinclock, LOW);
-    delayMicroseconds(200);
-    digitalWrite(pinclock, HIGH);
-    delayMicroseconds(200);
-  }
 
-  // Send the message (including a parity bit per word, and plus a parity word for the whole message)
-  for (byte i=0; i<=messageLength; i++) {
-    byte wordparity=1;
-    byte mr = (i==messageLength) ? messageparity : message[i];
-    for (byte j=0; j<5; j++) {
-      wordparity ^= (mr & 1);
-      if (j==4) mr=wordparity;
-      digitalWrite(pindata, (mr & 1) ? LOW : HIGH);
-      delayMicroseconds(200);
-      digitalWrite(pinclock, LOW);
-      delayMicroseconds(200);
-      digitalWrite(pinclock, HIGH);
-      delayMicroseconds(200);
-      mr>>=1;
+  //
+  // Show diagnostic data on Card Reader diagnostic screen
+  //
+  if (showingLastMessage) {
+    uint32_t age = millisSince(lastMessageWhen);
+    if (age > 300000) showingLastMessage=false;
+    else {
+      char *diagmsg = pageArena.wiegandDiagnostics;
+      int secondCount = age / 1000;
+      if (lastSecondCount != secondCount) {
+        lastSecondCount = secondCount;
+        strcpy_P(diagmsg, (const char*)lastMessageKind);
+        sprintf_P(&diagmsg[strlen(diagmsg)], PSTR(" received:\n%d bits %d sec ago"),lastMessageSize, lastSecondCount);
+      }
     }
   }
 
-  // Write epilogue, which is another ten clocks with data high
-  digitalWrite(pindata, HIGH);
-  for (byte i=0; i<10; i++) {
-    delayMicroseconds(200);
-    digitalWrite(pinclock, LOW);
-    delayMicroseconds(200);
-    digitalWrite(pinclock, HIGH);
-    delayMicroseconds(200);
+  // The LED mirror runs from interrupts, but needs to catch up after readerFeedback
+  // has been using the LED.
+  static bool feedbackHadLed;
+  if (readerFeedback::ownsLed()) feedbackHadLed = true;
+  else if (feedbackHadLed && ledInPin) {
+    feedbackHadLed = false;
+    noInterrupts();
+    mirrorLed();
+    interrupts();
+  }
+
+  // Abandoned PIN entries go to the Paxton as they are.  (OSDP readers can have
+  // numbers above readerCount.)
+  for (byte i=0; i<WIEGAND_READERS; i++) {
+    wiegandReader &r = readers[i];
+    if (r.pinLength && millis() - r.pinLastKeyWhen > PIN_ENTRY_TIMEOUT_MS) sendPinEntry(i);
   }
 
-  pinMode(PaxtonDataOutputPin, INPUT_PULLUP);
-  pinMode(PaxtonClockOutputPin, INPUT_PULLUP);
+  finishPendingSends();
 
+  // Messages from a Paxton reader go out as Wiegand, cards and keys alike
+  paxtonMessage pm;
+  while (usingPaxtonReaderInput && paxtonReceiver::take(pm)) {
+    uint32_t card;
+    byte key;
+    if (paxtonReceiver::cardNumber(pm, &card)) {
+      if (card == 0 || isDuplicateCard(card)) continue;
+      eventBus::publish(busCard, card);
+      wiegandCardOut(NULL, card);
+    } else if (paxtonReceiver::keypress(pm, &key)) {
+      if (!eventBus::publish(busKey, key)) wiegandKeyOut(key);
+    }
+  }
 
+  // Look for new Wiegand messages
+  for (byte i=0; i<readerCount; i++) {
+    wiegandFrame f;
+    if (takeFrame(readers[i], f)) processFrame(i, f);
+  }
 }
 
+
 // Outputs a card swipe message using the proprietary Paxton clock/data
 // card reader protocol (determined by scoping their reader).
 // Pin 0 is Data, Pin 1 is Clock (consistent with labeling on ACU)
-static void paxtonReaderOut(byte pindata, byte pinclock, uint32_t cardnumber) {
+static void paxtonReaderOut(byte channel, uint32_t cardnumber) {
 
   // Do not allow a card number of 0, Paxton doesn't like this
   if (cardnumber==0) return;
@@ -349,17 +1257,34 @@ static void paxtonReaderOut(byte pindata, byte pinclock, uint32_t cardnumber) {
     message[p--] = cardnumber % 10;
     cardnumber = cardnumber / 10;
   }
-  paxtonProtocolSend(pindata,pinclock,10,message);
+  paxtonProtocolSend(channel,10,message);
 }
 
-void paxtonSendBell() {
-  if (!using_paxton_protocol_to_net2_board) return;
-  paxtonKeypressOut(PaxtonDataOutputPin, PaxtonClockOutputPin, 'B');
+// The doorbell rings the Paxton as its bell key.
+static bool translateWiegand::onEvent(byte event, uint32_t value) {
+  if (event != busBell || value != 1 || !using_paxton_protocol_to_net2_board) return false;
+  paxtonKeypressOut(0, 'B');
+  return true;
 }
 
 // Send a keypress.  Valid keys are 0123456789*#B where B is the bell key.
-static void paxtonKeypressOut(byte pindata, byte pinclock, char key) {
+static void paxtonKeypressOut(byte channel, char key) {
   byte message[6];
+  if (paxtonKeypressFrame(key, message)) paxtonProtocolSend(channel,6,message);
+}
+
+// Send several keypresses as one burst
+static void paxtonKeypressesOut(byte channel, const char *keys, byte count) {
+  byte message[6 * (PIN_MAX_LENGTH + 1)];
+  byte frames = 0;
+  for (byte i=0; i<count && frames <= PIN_MAX_LENGTH; i++) {
+    if (paxtonKeypressFrame(keys[i], &message[frames * 6])) frames++;
+  }
+  if (frames) paxtonProtocolSend(channel,6,message,frames);
+}
+
+// Fills in the 6-word message for a keypress, returns false if key isn't a valid key.
+static bool paxtonKeypressFrame(char key, byte *message) {
   message[0]=0x0b;
   message[1]=0x0c;
   message[2]=0x00;
@@ -372,8 +1297,6 @@ static void paxtonKeypressOut(byte pindata, byte pinclock, char key) {
   else if (key=='*' || key==10) message[2]=0x01,message[3]=0x00;
   else if (key=='#' || key==11) message[2]=0x01,message[3]=0x01;
   else if (key=='B' || key==12) message[2]=0x01,message[3]=0x05;
-  else return;
-
-  paxtonProtocolSend(pindata,pinclock,6,message);
-
+  else return false;
+  return true;
 }